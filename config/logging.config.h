@@ -12,11 +12,65 @@
 */
 #define LOGGING ON
 
+/*!
+ * Min warning status of written logs: EMPTY, OK, WARNING or ERROR.
+ * Logs below it are removed at compile time, EMPTY logs are always written.
+ */
+#define MIN_LOG_LEVEL OK
+
 /*!
  * Print stack trace on every log object.
  */
 #define STACK_TRACE ON
+
+/*!
+ * Max number of frames in a stack trace.
+ */
+#define MAX_STACK_TRACE_DEPTH 64
 /*!
 * Max length of string that can be written as log.
 */
 #define MAX_LOGGING_STRING_LENGTH 1024
+
+/*!
+ * Limit number of logs written from one code position.
+ * Suppressed logs are counted and reported later.
+ */
+#define LOG_RATE_LIMIT ON
+
+/*!
+ * Length of the rate limit window in milliseconds.
+ */
+#define LOG_RATE_WINDOW 1000
+
+/*!
+ * Max number of logs from one code position per window.
+ */
+#define LOG_RATE_BURST 10
+
+/*!
+ * Initial size of memory for multilog records in bytes.
+ * It is doubled when records don't fit in it.
+ */
+#define SUBLOG_ARENA_SIZE 4096
+
+/*!
+ * Write logs from a background thread. Callers only put records
+ * into a bounded queue and don't wait for I/O.
+ * Requires linking with -pthread.
+ * Can be set from the command line: -DASYNC_LOGGING=ON.
+ */
+#ifndef ASYNC_LOGGING
+#define ASYNC_LOGGING OFF
+#endif
+
+/*!
+ * Number of records in the async logging queue. Must be a power of two.
+ */
+#define LOG_QUEUE_SIZE 256
+
+/*!
+ * What the async logging does when its queue is full:
+ * LOG_OVERFLOW_BLOCK, LOG_OVERFLOW_DROP or LOG_OVERFLOW_COUNT.
+ */
+#define DEFAULT_LOG_OVERFLOW LOG_OVERFLOW_BLOCK
@@ -13,6 +13,20 @@
  */
 #define VALIDATION ON
 
+/*!
+ * How deeply new stacks are checked in each operation
+ * (see validation_level_t). It can be changed by stack_set_validation().
+ */
+#define DEFAULT_VALIDATION_LEVEL VALIDATION_FULL
+
+/*!
+ * New stacks are fully checked every DEFAULT_CHECK_PERIOD-th operation
+ * regardless of validation level. 0 disables it. Other checks verify
+ * only elements changed since the previous check, so corruption
+ * of older elements is found only by this check or stack_check_full().
+ */
+#define DEFAULT_CHECK_PERIOD 256
+
  /*!
   * Protective barriers at the edges of the structure and data of the stack.
   */
@@ -24,6 +38,91 @@
 */
 #define HASH       ON 
 
+/*!
+ * Update the hash of stack data only for pushed or popped element
+ * instead of rehashing all the data after each operation.
+ * Full recalculation is still done by stack_check_full().
+ */
+#define INCREMENTAL_HASH ON
+
+/*!
+ * Function from hash.h which is used for calculating stack hash:
+ * fast_hash64 or pearson_hash64.
+ */
+#define HASH_FUNCTION fast_hash64
+
+/*!
+ * Use SSE2 or AVX2 versions of fast_hash64 if the processor supports them.
+ */
+#define HASH_SIMD  ON
+
+/*!
+ * Use SSE2 or AVX2 versions of poison_verify() if the processor
+ * supports them.
+ */
+#define POISON_SIMD ON
+
+/*!
+ * Checksum of the element in every node of concurrent_stack_t.
+ * It is calculated by push and checked by pop with HASH_FUNCTION.
+ */
+#define CONCURRENT_CHECKSUM ON
+
+/*!
+ * Push and pop of concurrent_stack_t which fail to change the top
+ * meet in the elimination array and exchange the element there.
+ */
+#define ELIMINATION ON
+
+/*!
+ * Number of slots in the elimination array of new concurrent stacks.
+ * 0 disables elimination.
+ */
+#define DEFAULT_ELIMINATION_SIZE 16
+
+/*!
+ * Number of spins for which push or pop waits for a partner in a slot.
+ */
+#define DEFAULT_ELIMINATION_SPIN 128
+
+/*!
+ * Number of elements which shared_stack_t moves at once between
+ * local stacks of workers and the common stack.
+ */
+#define DEFAULT_SHARED_BATCH 32
+
+/*!
+ * Local stack of a worker spills a batch to the common stack
+ * when it has so many elements.
+ */
+#define DEFAULT_SHARED_LOCAL_CAPACITY 128
+
+/*!
+ * Way of capacity changing for new stacks (see growth_policy_t).
+ */
+#define DEFAULT_GROWTH_POLICY GROWTH_DOUBLE
+
+/*!
+ * Number of elements by which capacity changes for GROWTH_FIXED_STEP.
+ */
+#define DEFAULT_GROWTH_STEP   256
+
+/*!
+ * Capacity of new stacks is reduced only if size <= capacity / it.
+ */
+#define DEFAULT_SHRINK_LOW_WATER 4
+
+/*!
+ * Options of new stacks (see stack_option_t).
+ */
+#define DEFAULT_STACK_OPTIONS STACK_NO_OPTIONS
+
+/*!
+ * Data buffers of stacks with STACK_HUGE_PAGES option are mapped
+ * with mmap if they are not smaller than this number of bytes.
+ */
+#define HUGE_PAGE_THRESHOLD (2 * 1024 * 1024)
+
 #define POISON     ((uint8_t)  145                  )
 #define POISON_PTR ((void*)    300                  )
 #define CANARY     ((uint64_t) 0x47C0DAB1EC0DEBEFULL)
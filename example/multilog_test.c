@@ -0,0 +1,95 @@
+#include "../src/secure_stack.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THREADS 8
+#define CHECKS  100
+#define LOGFILE "multilog_test.log"
+
+/*
+Every thread checks its own broken stack, so every check writes
+a multilog. Lines of a multilog must not be mixed with lines of
+multilogs of other threads.
+*/
+
+static void *checking_thread (void *arg)
+{
+	char name[32];
+	sprintf(name, "broken_stack_%zu", (size_t) arg);
+
+	stack_t *stack = stack_create_func_(name, sizeof(int));
+	for (int i = 0; i < 10; ++i)
+		stack_push(stack, &i);
+
+	/*
+	NEVER DO THIS!
+	The stack is broken on purpose, so the check writes the multilog.
+	*/
+	size_t low_water = stack->low_water;
+	stack->low_water = 0;
+
+	for (int i = 0; i < CHECKS; ++i)
+		stack_check(stack);
+
+	stack->low_water = low_water;
+	stack_delete(stack);
+	return NULL;
+}
+
+
+/* Returns number of the stack mentioned in the line or -1. */
+static long mentioned_stack (const char *line)
+{
+	const char *name = strstr(line, "broken_stack_");
+	if (!name)
+		return -1;
+	return strtol(name + strlen("broken_stack_"), NULL, 10);
+}
+
+
+int main (void)
+{
+	remove(LOGFILE);
+	set_logfile(LOGFILE);
+	set_log_rate_limit(LOG_RATE_WINDOW, 0);
+	start_logging();
+
+	pthread_t threads[THREADS];
+	for (size_t i = 0; i < THREADS; ++i)
+		pthread_create(&threads[i], NULL, checking_thread, (void *) i);
+	for (size_t i = 0; i < THREADS; ++i)
+		pthread_join(threads[i], NULL);
+
+	stop_logging();
+
+	FILE *log = fopen(LOGFILE, "r");
+	if (!log)
+	{
+		printf("Log file wasn't written\n");
+		return 1;
+	}
+
+	char line[1024];
+	long current = -1;
+	size_t multilogs = 0, mixed = 0;
+	while (fgets(line, sizeof line, log))
+	{
+		long stack = mentioned_stack(line);
+		if (strncmp(line, "stack_t broken_stack_", 21) == 0)
+		{
+			current = stack;
+			++multilogs;
+		}
+		else if (stack != -1 && stack != current)
+			++mixed;
+	}
+	fclose(log);
+
+	printf("%s logging: %zu multilogs, %zu mixed lines\n",
+			ASYNC_LOGGING == ON ? "Async" : "Sync", multilogs, mixed);
+
+	/* stack_delete() may check the stack once more. */
+	return multilogs < THREADS * CHECKS || mixed != 0;
+}
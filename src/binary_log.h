@@ -0,0 +1,116 @@
+/*!
+ * @file
+ * @brief Format of binary log files.
+ *
+ * File starts with binlog_file_header_t. It is followed by records,
+ * each of them starts with a byte of binlog_record_type_t.
+ * Code positions are written once as BINLOG_POSITION records,
+ * log entries refer to them by id. Stack traces are stored as raw
+ * return addresses, symbol of each address is written once
+ * as BINLOG_FRAME record. All numbers are in
+ * the byte order of the machine which wrote the log.
+ */
+
+
+
+
+#ifndef _BINARY_LOG_H_
+
+#define _BINARY_LOG_H_
+
+
+
+
+/*================= Connecting headers ==================*/
+
+
+#include <stdint.h>
+
+
+
+
+/*====================== Constants =======================*/
+
+
+#define BINLOG_MAGIC      "SSLG"
+#define BINLOG_VERSION    2
+#define BINLOG_BYTE_ORDER 0x0102
+
+/*! Entry has stack trace section. */
+#define BINLOG_HAS_TRACE  (1U << 0)
+
+
+
+
+/*========================= Types ========================*/
+
+
+typedef enum binlog_record_type_t_
+{
+	BINLOG_ENTRY    = 1, /*!< Log entry. */
+	BINLOG_POSITION = 2, /*!< Definition of a code position id. */
+	BINLOG_FRAME    = 3, /*!< Symbol of a return address. */
+} binlog_record_type_t;
+
+
+/*!
+ * Header of the binary log file.
+ */
+typedef struct binlog_file_header_t_
+{
+	char     magic[4];   /*!< BINLOG_MAGIC without terminating zero. */
+	uint16_t version;    /*!< BINLOG_VERSION. */
+	uint16_t byte_order; /*!< BINLOG_BYTE_ORDER as written by the logger. */
+} binlog_file_header_t;
+
+
+/*!
+ * Log entry. It is followed by msg_length bytes of message,
+ * data_length bytes of data and trace_depth 64-bit return addresses.
+ * Strings have no terminating zeros.
+ */
+typedef struct binlog_entry_t_
+{
+	uint8_t  type;         /*!< BINLOG_ENTRY. */
+	uint8_t  danger;       /*!< danger_status_t of the log. */
+	uint16_t deep_lvl;     /*!< Nesting level of the log. */
+	uint32_t position;     /*!< Id of the code position. */
+	uint64_t timestamp;    /*!< Nanoseconds since the Epoch. */
+	uint32_t msg_length;
+	uint32_t data_length;
+	uint32_t trace_depth;
+	uint32_t flags;        /*!< BINLOG_HAS_TRACE. */
+} binlog_entry_t;
+
+
+/*!
+ * Definition of a code position id. It is followed by fname_length
+ * bytes of the file name and func_length bytes of the function name.
+ * It is written before the first entry which uses the id.
+ */
+typedef struct binlog_position_t_
+{
+	uint8_t  type;         /*!< BINLOG_POSITION. */
+	uint8_t  reserved[3];
+	uint32_t id;
+	uint32_t line;
+	uint32_t fname_length;
+	uint32_t func_length;
+} binlog_position_t;
+
+
+/*!
+ * Symbol of a return address. It is followed by symbol_length
+ * bytes of the symbol. It is written before the first entry
+ * which has the address in its stack trace.
+ */
+typedef struct binlog_frame_t_
+{
+	uint8_t  type;          /*!< BINLOG_FRAME. */
+	uint8_t  reserved[3];
+	uint32_t symbol_length;
+	uint64_t address;
+} binlog_frame_t;
+
+
+#endif
@@ -0,0 +1,946 @@
+/*!
+ * @file
+ * @brief A source code of functions for working with the concurrent stack.
+ */
+
+
+
+
+/*================= Connecting headers ==================*/
+
+
+#include "concurrent_stack.h"
+#include "others.h"
+
+#if CONCURRENT_CHECKSUM == ON
+	#include "hash.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+
+
+
+/*================== Local functions =====================*/
+
+
+/*! Heads of lists contain index + 1 of the first node in the low half
+ *  and the tag in the high half. Index 0 means the empty list.
+ */
+#define NIL_NODE_     0
+#define MAX_CAPACITY_ ((size_t) UINT32_MAX - 1)
+
+#define head_index(HEAD_) ((uint32_t) (HEAD_))
+
+
+/*! Header of a node. The element follows it and the right canary
+ *  follows the element.
+ */
+typedef struct node_t_
+{
+	#if CANARIES == ON
+		unsigned long long left_canary;
+	#endif
+
+	_Atomic uint32_t next; /* index + 1 of the next node in the list. */
+
+	#if CONCURRENT_CHECKSUM == ON
+		uint64_t checksum; /* hash of the element. */
+	#endif
+} node_t;
+
+
+static size_t align_up (size_t value, size_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+
+/* Elements are aligned as well as malloc aligns memory. */
+static size_t node_element_offset (void)
+{
+	return align_up(sizeof(node_t), _Alignof(max_align_t));
+}
+
+
+static size_t node_canary_offset (size_t element_size)
+{
+	return align_up(node_element_offset() + element_size,
+			sizeof(unsigned long long));
+}
+
+
+static node_t *get_node (const concurrent_stack_t *stack, uint32_t index)
+{
+	return (node_t *) ((char *) stack->nodes +
+			(size_t) (index - 1) * stack->node_size);
+}
+
+
+static void *node_element (node_t *node)
+{
+	return (char *) node + node_element_offset();
+}
+
+
+#if CANARIES == ON
+
+static unsigned long long *node_right_canary (const concurrent_stack_t *stack,
+		node_t *node)
+{
+	return (unsigned long long *) ((char *) node +
+			node_canary_offset(stack->element_size));
+}
+
+#endif
+
+
+static uint64_t new_head (uint64_t old_head, uint32_t index)
+{
+	return (((old_head >> 32) + 1) << 32) | index;
+}
+
+
+#if ELIMINATION == ON
+
+/*! Value of an elimination slot contains index + 1 of the node
+ *  in the low half, the state in the next two bits and the tag
+ *  in the rest bits.
+ */
+#define SLOT_EMPTY_ 0 /* nobody waits in the slot.                     */
+#define SLOT_PUSH_  1 /* push waits for pop with the node.             */
+#define SLOT_POP_   2 /* pop waits for push.                           */
+#define SLOT_DONE_  3 /* push has given the node to the waiting pop.   */
+
+#define slot_state(VALUE_) ((unsigned) ((VALUE_) >> 32) & 3)
+
+/*! Max number of elimination slots. */
+#define MAX_ELIMINATION_SIZE_ 1024
+
+
+/* Slots are in separate cache lines. */
+typedef struct elimination_slot_t_
+{
+	_Alignas(64) _Atomic uint64_t value;
+} elimination_slot_t;
+
+
+static _Thread_local uint32_t ELIMINATION_SEED_ = 0;
+
+
+static uint64_t new_slot (uint64_t old_value, unsigned state, uint32_t index)
+{
+	return (((old_value >> 34) + 1) << 34) | ((uint64_t) state << 32) |
+	       index;
+}
+
+
+static void cpu_relax (void)
+{
+	#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+	#endif
+}
+
+
+/* Chooses a random slot among the used ones. */
+static elimination_slot_t *choose_slot (concurrent_stack_t *stack)
+{
+	uint32_t seed = ELIMINATION_SEED_;
+	if (seed == 0)
+		seed = (uint32_t) (uintptr_t) &ELIMINATION_SEED_ | 1;
+
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	ELIMINATION_SEED_ = seed;
+
+	size_t range = atomic_load_explicit(&stack->elimination_range,
+			memory_order_relaxed);
+	return &stack->elimination[seed % range];
+}
+
+
+/* Busy slots mean that many threads meet in the array,
+ * so more slots are used. A partner which isn't found in time
+ * means that threads are too scattered, so less slots are used. */
+static void adapt_range (concurrent_stack_t *stack, bool busy)
+{
+	size_t range = atomic_load_explicit(&stack->elimination_range,
+			memory_order_relaxed);
+	size_t new_range = busy ? range * 2 : range / 2;
+
+	if (new_range > stack->elimination_size)
+		new_range = stack->elimination_size;
+	if (new_range < 1)
+		new_range = 1;
+
+	if (new_range != range)
+		atomic_store_explicit(&stack->elimination_range, new_range,
+				memory_order_relaxed);
+}
+
+
+/* Tries to give the node to a popping thread. */
+static bool eliminate_push (concurrent_stack_t *stack, uint32_t index)
+{
+	elimination_slot_t *slot = choose_slot(stack);
+	uint64_t value = atomic_load_explicit(&slot->value, memory_order_relaxed);
+
+	if (slot_state(value) == SLOT_POP_)
+	{
+		if (atomic_compare_exchange_strong_explicit(&slot->value, &value,
+				new_slot(value, SLOT_DONE_, index),
+				memory_order_release, memory_order_relaxed))
+			return true;
+
+		adapt_range(stack, true);
+		return false;
+	}
+
+	uint64_t posted = new_slot(value, SLOT_PUSH_, index);
+	if (slot_state(value) != SLOT_EMPTY_ ||
+	    !atomic_compare_exchange_strong_explicit(&slot->value, &value,
+			posted, memory_order_release, memory_order_relaxed))
+	{
+		adapt_range(stack, true);
+		return false;
+	}
+
+	for (unsigned i = 0; i < stack->elimination_spin; ++i)
+	{
+		if (atomic_load_explicit(&slot->value,
+				memory_order_relaxed) != posted)
+			return true;
+		cpu_relax();
+	}
+
+	/* If the node can't be taken back, pop has already taken it. */
+	if (atomic_compare_exchange_strong_explicit(&slot->value, &posted,
+			new_slot(posted, SLOT_EMPTY_, NIL_NODE_),
+			memory_order_relaxed, memory_order_relaxed))
+	{
+		adapt_range(stack, false);
+		return false;
+	}
+	return true;
+}
+
+
+/* Tries to take the node from a pushing thread. */
+static bool eliminate_pop (concurrent_stack_t *stack, uint32_t *index)
+{
+	elimination_slot_t *slot = choose_slot(stack);
+	uint64_t value = atomic_load_explicit(&slot->value, memory_order_relaxed);
+
+	if (slot_state(value) == SLOT_PUSH_)
+	{
+		if (atomic_compare_exchange_strong_explicit(&slot->value, &value,
+				new_slot(value, SLOT_EMPTY_, NIL_NODE_),
+				memory_order_acquire, memory_order_relaxed))
+		{
+			*index = head_index(value);
+			return true;
+		}
+
+		adapt_range(stack, true);
+		return false;
+	}
+
+	uint64_t posted = new_slot(value, SLOT_POP_, NIL_NODE_);
+	if (slot_state(value) != SLOT_EMPTY_ ||
+	    !atomic_compare_exchange_strong_explicit(&slot->value, &value,
+			posted, memory_order_relaxed, memory_order_relaxed))
+	{
+		adapt_range(stack, true);
+		return false;
+	}
+
+	for (unsigned i = 0; i < stack->elimination_spin; ++i)
+	{
+		value = atomic_load_explicit(&slot->value, memory_order_acquire);
+		if (value != posted)
+			break;
+		cpu_relax();
+	}
+
+	if (value == posted)
+	{
+		if (atomic_compare_exchange_strong_explicit(&slot->value, &value,
+				new_slot(posted, SLOT_EMPTY_, NIL_NODE_),
+				memory_order_acquire, memory_order_acquire))
+		{
+			adapt_range(stack, false);
+			return false;
+		}
+	}
+
+	/* Only push changes the waiting slot, it has made it SLOT_DONE_.
+	 * Nobody else changes the slot in this state. */
+	*index = head_index(value);
+	atomic_store_explicit(&slot->value,
+			new_slot(value, SLOT_EMPTY_, NIL_NODE_), memory_order_relaxed);
+	return true;
+}
+
+
+static bool elimination_enabled (const concurrent_stack_t *stack)
+{
+	return stack->elimination_size > 0;
+}
+
+
+static bool elimination_fields_good (concurrent_stack_t *stack)
+{
+	size_t range = atomic_load_explicit(&stack->elimination_range,
+			memory_order_relaxed);
+
+	return stack->elimination_size <= MAX_ELIMINATION_SIZE_ &&
+	       range >= 1 && (stack->elimination_size == 0 ||
+	                      range <= stack->elimination_size);
+}
+
+
+/* Replaces the elimination array by the new one with size slots. */
+static stack_error_t alloc_elimination (concurrent_stack_t *stack,
+		size_t size, unsigned spin)
+{
+	elimination_slot_t *slots = NULL;
+
+	if (size > 0)
+	{
+		slots = (elimination_slot_t *) aligned_alloc(
+				_Alignof(elimination_slot_t), size * sizeof *slots);
+		if (!slots)
+			return ALLOCATION_ERROR;
+
+		for (size_t i = 0; i < size; ++i)
+			atomic_init(&slots[i].value, SLOT_EMPTY_);
+	}
+
+	if (stack->elimination)
+	{
+		mem_cache_invalidate(stack->elimination,
+				stack->elimination_size * sizeof *stack->elimination);
+		free(stack->elimination);
+	}
+
+	stack->elimination      = slots;
+	stack->elimination_size = size;
+	stack->elimination_spin = spin;
+	atomic_store(&stack->elimination_range, 1);
+
+	return STACK_OK;
+}
+
+#else
+
+#define eliminate_push(STACK_, INDEX_)  false
+#define eliminate_pop(STACK_, INDEX_)   false
+#define elimination_enabled(STACK_)     false
+
+#endif
+
+
+/* Adds the node to the list. Release order publishes the element
+ * and the link to the thread which takes the node. If eliminate is true,
+ * the node can be given to pop through the elimination array. */
+static void put_node (concurrent_stack_t *stack, _Atomic uint64_t *head,
+		uint32_t index, bool eliminate)
+{
+	node_t *node = get_node(stack, index);
+	uint64_t old_head = atomic_load_explicit(head, memory_order_relaxed);
+
+	for (;;)
+	{
+		atomic_store_explicit(&node->next, head_index(old_head),
+				memory_order_relaxed);
+
+		if (atomic_compare_exchange_weak_explicit(head, &old_head,
+				new_head(old_head, index),
+				memory_order_release, memory_order_relaxed))
+			return;
+
+		if (eliminate && elimination_enabled(stack) &&
+		    eliminate_push(stack, index))
+			return;
+	}
+}
+
+
+/* Removes the first node from the list. The next field can be read
+ * when the node is already taken by another thread, but the changed
+ * tag of the head makes the exchange fail in this case. */
+static stack_error_t take_node (concurrent_stack_t *stack,
+		_Atomic uint64_t *head, uint32_t *index, bool eliminate)
+{
+	uint64_t old_head = atomic_load_explicit(head, memory_order_acquire);
+
+	for (;;)
+	{
+		uint32_t first = head_index(old_head);
+		if (first == NIL_NODE_)
+			return STACK_EMPTY;
+
+		#if VALIDATION == ON
+
+			if_log (first > stack->capacity, ERROR)
+				return SOME_ERROR;
+
+		#endif
+
+		uint32_t next = atomic_load_explicit(&get_node(stack, first)->next,
+				memory_order_relaxed);
+
+		if (atomic_compare_exchange_weak_explicit(head, &old_head,
+				new_head(old_head, next),
+				memory_order_acquire, memory_order_acquire))
+		{
+			*index = first;
+			return STACK_OK;
+		}
+
+		if (eliminate && elimination_enabled(stack) &&
+		    eliminate_pop(stack, &first))
+		{
+			#if VALIDATION == ON
+
+				if_log (first > stack->capacity, ERROR)
+					return SOME_ERROR;
+
+			#endif
+
+			*index = first;
+			return STACK_OK;
+		}
+	}
+}
+
+
+static void init_node (concurrent_stack_t *stack, node_t *node)
+{
+	#if CANARIES == ON
+		node->left_canary = CANARY;
+		*node_right_canary(stack, node) = CANARY;
+	#endif
+
+	poison_fill(node_element(node), POISON, stack->element_size);
+
+	#if CONCURRENT_CHECKSUM == ON
+		node->checksum = 0;
+	#endif
+}
+
+
+static bool node_canaries_good (const concurrent_stack_t *stack, node_t *node)
+{
+	#if CANARIES == ON
+		return node->left_canary == CANARY &&
+		       *node_right_canary(stack, node) == CANARY;
+	#else
+		(void) stack, (void) node;
+		return true;
+	#endif
+}
+
+
+static bool node_checksum_good (const concurrent_stack_t *stack,
+		node_t *node)
+{
+	#if CONCURRENT_CHECKSUM == ON
+		return node->checksum ==
+		       HASH_FUNCTION(node_element(node), stack->element_size);
+	#else
+		(void) stack, (void) node;
+		return true;
+	#endif
+}
+
+
+#if VALIDATION == ON
+
+/* Writes the log about the damaged node. */
+static void report_node (const concurrent_stack_t *stack, uint32_t index,
+		const char *msg, _CODE_POSITION_T_)
+{
+	(void) msg, (void) fname, (void) func, (void) line;
+
+	if (!log_level_enabled(ERROR))
+		return;
+
+	char str[200];
+	sprintf(str, "concurrent_stack_t %s; node %u of %zu at %p",
+			stack->name, (unsigned) index - 1, stack->capacity,
+			(void *) get_node(stack, index));
+	write_log_at(msg, str, ERROR, 0, _CODE_POSITION_);
+}
+
+
+/* Checks the fields which operations use. Nodes are checked
+ * only when an operation takes them. */
+static stack_error_t validate_header (concurrent_stack_t *stack)
+{
+	if_log (is_bad_ptr(stack), ERROR)
+		return INVALID_PTR;
+
+	#if CANARIES == ON
+
+		if_log (stack->left_canary != CANARY ||
+		        stack->right_canary != CANARY, ERROR)
+			return SOME_ERROR;
+
+	#endif
+
+	if_log (stack->element_size == 0 || stack->capacity == 0 ||
+	        stack->capacity > MAX_CAPACITY_, ERROR)
+		return SOME_ERROR;
+
+	if_log (is_bad_mem(stack->nodes, stack->capacity * stack->node_size),
+			ERROR)
+		return INVALID_DATA_PTR;
+
+	#if ELIMINATION == ON
+
+		if_log (!elimination_fields_good(stack), ERROR)
+			return SOME_ERROR;
+
+	#endif
+
+	return STACK_OK;
+}
+
+#endif
+
+
+/* Walks through the list, checks its nodes and counts them.
+ * A loop in the list is found by the count exceeding capacity. */
+static bool check_list (concurrent_stack_t *stack, _Atomic uint64_t *head,
+		bool checksum, size_t *count, bool verbose)
+{
+	*count = 0;
+	uint32_t index = head_index(atomic_load(head));
+
+	char str[200];
+
+	while (index != NIL_NODE_)
+	{
+		if (index > stack->capacity || *count >= stack->capacity)
+		{
+			if (verbose)
+			{
+				sprintf(str, "%s: index %u, %zu nodes passed", stack->name,
+						(unsigned) index, *count);
+				add_sublog("List of nodes is broken!", str, ERROR, 2);
+			}
+			return false;
+		}
+
+		node_t *node = get_node(stack, index);
+		bool good = node_canaries_good(stack, node) &&
+		            (!checksum || node_checksum_good(stack, node));
+		if (!good)
+		{
+			if (verbose)
+			{
+				sprintf(str, "%s: node %u at %p", stack->name,
+						(unsigned) index - 1, (void *) node);
+				add_sublog("Node is damaged!", str, ERROR, 2);
+			}
+			return false;
+		}
+
+		++*count;
+		index = atomic_load(&node->next);
+	}
+
+	return true;
+}
+
+
+/* Checks the stack and logs the results only if verbose is true. */
+static stack_error_t check_pass (concurrent_stack_t *stack, bool verbose,
+		_CODE_POSITION_T_)
+{
+	(void) fname, (void) func, (void) line;
+
+	char str[300];
+
+	if (is_bad_ptr(stack))
+	{
+		if (verbose)
+		{
+			sprintf(str, "concurrent_stack_t *unknown = %p", (void *) stack);
+			write_log_at("Pointer to stack is bad!", str, ERROR, 0,
+					_CODE_POSITION_);
+		}
+		return INVALID_PTR;
+	}
+
+	if (verbose)
+	{
+		sprintf(str, "concurrent_stack_t %s", stack->name);
+		multilog_begin_at("Concurrent stack checking...", str,
+				_CODE_POSITION_);
+	}
+
+	bool error = false;
+
+	#if CANARIES == ON
+
+		if (stack->left_canary != CANARY || stack->right_canary != CANARY)
+		{
+			if (verbose)
+			{
+				sprintf(str, "%s->left_canary = %llx, "
+						"%s->right_canary = %llx, CANARY = %lx",
+						stack->name, stack->left_canary,
+						stack->name, stack->right_canary, CANARY);
+				add_sublog("Canaries incorrect!", str, WARNING, 2);
+			}
+			error = true;
+		}
+
+	#endif
+
+	bool bad_fields = stack->element_size == 0 || stack->capacity == 0 ||
+	                  stack->capacity > MAX_CAPACITY_ ||
+	                  stack->node_size < node_canary_offset(
+	                      stack->element_size);
+	bool bad_nodes = bad_fields || is_bad_mem(stack->nodes,
+			stack->capacity * stack->node_size);
+
+	if (bad_nodes)
+	{
+		if (verbose)
+		{
+			sprintf(str, "%s->element_size = %zu, %s->capacity = %zu, "
+					"%s->nodes = %p", stack->name, stack->element_size,
+					stack->name, stack->capacity, stack->name, stack->nodes);
+			add_sublog("Fields or pointer to nodes incorrect!", str,
+					ERROR, 2);
+			multilog_end(WARNING);
+		}
+		return bad_fields ? SOME_ERROR : INVALID_DATA_PTR;
+	}
+
+	#if ELIMINATION == ON
+
+		bad_fields = !elimination_fields_good(stack);
+		if (bad_fields || (elimination_enabled(stack) &&
+		    is_bad_mem(stack->elimination,
+				stack->elimination_size * sizeof *stack->elimination)))
+		{
+			if (verbose)
+			{
+				sprintf(str, "%s->elimination = %p, "
+						"%s->elimination_size = %zu, range = %zu",
+						stack->name, (void *) stack->elimination,
+						stack->name, stack->elimination_size,
+						atomic_load(&stack->elimination_range));
+				add_sublog("Elimination array incorrect!", str, ERROR, 2);
+				multilog_end(WARNING);
+			}
+			return bad_fields ? SOME_ERROR : INVALID_DATA_PTR;
+		}
+
+		/* Nobody waits in the slots of the quiescent stack. */
+		for (size_t i = 0; i < stack->elimination_size; ++i)
+		{
+			uint64_t value = atomic_load(&stack->elimination[i].value);
+			if (slot_state(value) != SLOT_EMPTY_)
+			{
+				if (verbose)
+				{
+					sprintf(str, "%s->elimination[%zu] = %llx", stack->name,
+							i, (unsigned long long) value);
+					add_sublog("Elimination slot isn't empty!", str,
+							ERROR, 2);
+				}
+				error = true;
+			}
+		}
+
+	#endif
+
+	size_t used = 0, free_count = 0;
+	if (!check_list(stack, &stack->top, true, &used, verbose) ||
+	    !check_list(stack, &stack->free_list, false, &free_count, verbose))
+		error = true;
+	else if (used != atomic_load(&stack->size) ||
+	         used + free_count != stack->capacity)
+	{
+		if (verbose)
+		{
+			sprintf(str, "%s->size = %zu, %zu nodes in the stack, "
+					"%zu free nodes, %s->capacity = %zu", stack->name,
+					atomic_load(&stack->size), used, free_count,
+					stack->name, stack->capacity);
+			add_sublog("Nodes are lost!", str, ERROR, 2);
+		}
+		error = true;
+	}
+
+	if (verbose)
+	{
+		multilog_end(WARNING);
+	}
+
+	if (error)
+		return SOME_ERROR;
+	else
+		return STACK_OK;
+}
+
+
+
+
+/*=================== Global functions ===================*/
+
+
+concurrent_stack_t *concurrent_stack_create_func_ (const char *name,
+		size_t element_size, size_t capacity)
+{
+	#if VALIDATION == ON
+
+	if_log (element_size <= 0, ERROR)
+		return NULL;
+
+	if_log (capacity == 0 || capacity > MAX_CAPACITY_, ERROR)
+		return NULL;
+
+	if_log (is_bad_ptr(name), ERROR)
+		name = "UNKNOWN";
+
+	#endif
+
+	/* Indexes of nodes are 32-bit and the pool size must not
+	 * overflow, even if the arguments aren't validated. */
+	if (capacity == 0 || capacity > MAX_CAPACITY_ ||
+	    element_size > SIZE_MAX / 2)
+		return NULL;
+
+	size_t node_size = align_up(node_canary_offset(element_size) +
+	                            (CANARIES == ON ?
+	                             sizeof(unsigned long long) : 0),
+	                            _Alignof(max_align_t));
+	if (capacity > SIZE_MAX / node_size)
+		return NULL;
+
+	concurrent_stack_t *stack = (concurrent_stack_t *) aligned_alloc(
+			_Alignof(concurrent_stack_t), sizeof *stack);
+	if (!stack)
+		return NULL;
+
+	memset(stack, 0, sizeof *stack);
+	strncpy(stack->name, name, sizeof stack->name - 1);
+
+	stack->element_size = element_size;
+	stack->capacity     = capacity;
+	stack->node_size    = node_size;
+
+	stack->nodes = malloc(capacity * stack->node_size);
+	if (!stack->nodes)
+	{
+		free(stack);
+		return NULL;
+	}
+
+	#if ELIMINATION == ON
+
+		if (alloc_elimination(stack, DEFAULT_ELIMINATION_SIZE,
+				DEFAULT_ELIMINATION_SPIN) != STACK_OK)
+		{
+			free(stack->nodes);
+			free(stack);
+			return NULL;
+		}
+
+	#endif
+
+	#if CANARIES == ON
+		stack->left_canary = stack->right_canary = CANARY;
+	#endif
+
+	/* All nodes are free, the first node is on the top of free list. */
+	for (uint32_t index = 1; index <= capacity; ++index)
+	{
+		node_t *node = get_node(stack, index);
+		init_node(stack, node);
+		atomic_init(&node->next, index < capacity ? index + 1 : NIL_NODE_);
+	}
+
+	atomic_init(&stack->top, NIL_NODE_);
+	atomic_init(&stack->free_list, 1);
+	atomic_init(&stack->size, 0);
+
+	return stack;
+}
+
+
+stack_error_t concurrent_stack_delete (concurrent_stack_t *stack)
+{
+	if (!stack)
+		return STACK_OK;
+
+	stack_error_t error = STACK_OK;
+
+	#if VALIDATION == ON
+
+	error = concurrent_stack_check(stack);
+	if (error == INVALID_PTR)
+		return error;
+
+	#endif
+
+	if (error != INVALID_DATA_PTR)
+	{
+		mem_cache_invalidate(stack->nodes,
+				stack->capacity * stack->node_size);
+		free(stack->nodes);
+
+		#if ELIMINATION == ON
+			alloc_elimination(stack, 0, 0);
+		#endif
+	}
+
+	mem_cache_invalidate(stack, sizeof *stack);
+	free(stack);
+
+	return error;
+}
+
+
+stack_error_t concurrent_stack_check_func_ (concurrent_stack_t *stack,
+		_CODE_POSITION_T_)
+{
+	stack_error_t error = check_pass(stack, false, _CODE_POSITION_);
+
+	if (error != STACK_OK)
+		error = check_pass(stack, true, _CODE_POSITION_);
+
+	return error;
+}
+
+
+stack_error_t concurrent_stack_push (concurrent_stack_t *stack,
+		const void *pushed_value)
+{
+	#if VALIDATION == ON
+
+		stack_error_t valid = validate_header(stack);
+		if (valid != STACK_OK)
+			return valid;
+
+		if_log (is_bad_mem(pushed_value, stack->element_size), ERROR)
+			return INVALID_PTR;
+
+	#endif
+
+	uint32_t index = NIL_NODE_;
+	stack_error_t error = take_node(stack, &stack->free_list, &index, false);
+	if (error == STACK_EMPTY)
+		return STACK_FULL;
+	if (error != STACK_OK)
+		return error;
+
+	node_t *node = get_node(stack, index);
+
+	#if VALIDATION == ON
+
+		/* Free node is damaged by a neighbour. It isn't returned
+		 * to the pool. */
+		if (!node_canaries_good(stack, node))
+		{
+			report_node(stack, index, "Canaries of free node incorrect!",
+					_CURRENT_CODE_POSITION_);
+			return SOME_ERROR;
+		}
+
+	#endif
+
+	memcpy(node_element(node), pushed_value, stack->element_size);
+
+	#if CONCURRENT_CHECKSUM == ON
+		node->checksum = HASH_FUNCTION(node_element(node),
+				stack->element_size);
+	#endif
+
+	atomic_fetch_add_explicit(&stack->size, 1, memory_order_relaxed);
+	put_node(stack, &stack->top, index, true);
+
+	return STACK_OK;
+}
+
+
+stack_error_t concurrent_stack_pop (concurrent_stack_t *stack, void *result)
+{
+	#if VALIDATION == ON
+
+		stack_error_t valid = validate_header(stack);
+		if (valid != STACK_OK)
+			return valid;
+
+		if_log (is_bad_mem(result, stack->element_size), ERROR)
+			return INVALID_PTR;
+
+	#endif
+
+	uint32_t index = NIL_NODE_;
+	stack_error_t error = take_node(stack, &stack->top, &index, true);
+	if (error != STACK_OK)
+		return error;
+
+	atomic_fetch_sub_explicit(&stack->size, 1, memory_order_relaxed);
+	node_t *node = get_node(stack, index);
+
+	#if VALIDATION == ON
+
+		/* Damaged node isn't returned to the pool, so its memory
+		 * isn't used again. */
+		if (!node_canaries_good(stack, node))
+		{
+			report_node(stack, index, "Canaries of node incorrect!",
+					_CURRENT_CODE_POSITION_);
+			return SOME_ERROR;
+		}
+		if (!node_checksum_good(stack, node))
+		{
+			report_node(stack, index, "Checksum of node incorrect!",
+					_CURRENT_CODE_POSITION_);
+			return SOME_ERROR;
+		}
+
+	#endif
+
+	memcpy(result, node_element(node), stack->element_size);
+	poison_fill(node_element(node), POISON, stack->element_size);
+
+	put_node(stack, &stack->free_list, index, false);
+
+	return STACK_OK;
+}
+
+
+#if ELIMINATION == ON
+
+stack_error_t concurrent_stack_set_elimination (concurrent_stack_t *stack,
+		size_t size, unsigned spin)
+{
+	#if VALIDATION == ON
+
+		stack_error_t error = validate_header(stack);
+		if (error != STACK_OK)
+			return error;
+
+		if_log (size > MAX_ELIMINATION_SIZE_, ERROR)
+			return SOME_ERROR;
+
+	#endif
+
+	return alloc_elimination(stack, size, spin);
+}
+
+#endif
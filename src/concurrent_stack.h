@@ -0,0 +1,221 @@
+/*!
+ * @file
+ * This header file contains a description of the concurrent stack
+ * and functions for working with it.
+ *
+ * Push and pop of concurrent_stack_t are lock-free and can be called
+ * from any number of threads. Elements are stored in nodes of a pool
+ * which is allocated by the constructor, so the capacity is fixed.
+ * Free nodes and nodes of the stack are kept in two Treiber stacks,
+ * their heads contain a tag which is changed by every operation
+ * to prevent the ABA problem.
+ *
+ * If ELIMINATION is ON, push and pop which lose the race for the top
+ * try to meet in a random slot of the elimination array: the pushed node
+ * is given to the popping thread and the top isn't changed at all.
+ * The number of used slots adapts to the contention.
+ */
+
+
+
+
+#ifndef CONCURRENT_STACK_H_
+#define CONCURRENT_STACK_H_
+
+
+
+
+/*================= Connecting headers ==================*/
+
+
+#include "secure_stack.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+
+
+
+/*========================= Types ========================*/
+
+
+struct elimination_slot_t_;
+
+
+/*! It is concurrent stack type.
+ *
+ *  Heads are in separate cache lines, so threads which change one of them
+ *  don't slow down the others.
+ */
+typedef struct concurrent_stack_t_
+{
+	#if CANARIES == ON
+		unsigned long long left_canary; /*!< left protective variable. */
+	#endif
+
+	void  *nodes;        /*!< pool of capacity nodes.                    */
+	size_t element_size; /*!< size of one element in stack.              */
+	size_t node_size;    /*!< size of one node with its element.         */
+	size_t capacity;     /*!< number of nodes in the pool.               */
+	char   name[64];     /*!< name of concurrent_stack_t variable.       */
+
+	#if ELIMINATION == ON
+		struct elimination_slot_t_ *elimination; /*!< elimination array. */
+		size_t   elimination_size; /*!< number of slots, 0 - disabled.   */
+		unsigned elimination_spin; /*!< spins waiting for a partner.     */
+	#endif
+
+	#if CANARIES == ON
+		unsigned long long right_canary; /*!< right protective variable. */
+	#endif
+
+	_Alignas(64) _Atomic uint64_t top;       /*!< head of the stack.      */
+	_Alignas(64) _Atomic uint64_t free_list; /*!< head of free nodes.     */
+	_Alignas(64) atomic_size_t    size;      /*!< number of elements.     */
+
+	#if ELIMINATION == ON
+		/*! number of slots which are used now. */
+		_Alignas(64) atomic_size_t elimination_range;
+	#endif
+} concurrent_stack_t;
+
+
+
+
+/*================= Function prototypes ==================*/
+
+
+/*! This function creates concurrent stack on heap and allocates
+ *  the pool of nodes for capacity elements.
+ *
+ * @param[in] name         - name of stack variable.
+ * @param[in] element_size - size of one element in stack.
+ * @param[in] capacity     - max number of elements in the stack.
+ *
+ * @return pointer to initialized concurrent_stack_t value
+ *         or NULL if memory can't be allocated.
+ *
+ * @note Don't forget to free heap memory using concurrent_stack_delete().
+ *
+ * @note Use concurrent_stack_create() macro instead of this function.
+ */
+concurrent_stack_t *concurrent_stack_create_func_ (const char *name,
+		size_t element_size, size_t capacity);
+
+
+/*! This function frees heap memory that concurrent_stack_t* value used.
+ *
+ *  @param[in,out] stack - pointer to the stack to be freed.
+ *
+ *  @return stack_error.
+ *
+ *  @note No other thread may use the stack during this call.
+ */
+stack_error_t concurrent_stack_delete (concurrent_stack_t *stack);
+
+
+/*! This function checks the stack and all its nodes for integrity.
+ *
+ * @param[in] stack           - stack to be checked.
+ * @param[in] _CODE_POSITION_ - position in source code.
+ *
+ * @return stack_error
+ *
+ * @note No other thread may change the stack during this call.
+ *
+ * @note Use concurrent_stack_check() macro instead of this function.
+ */
+stack_error_t concurrent_stack_check_func_ (concurrent_stack_t *stack,
+		_CODE_POSITION_T_);
+
+
+/*! This function pushes a value to the stack.
+ *
+ *  @param[in,out] stack    - pointer to the stack.
+ *  @param[in] pushed_value - pointer to the value that will be pushed.
+ *
+ *  @return stack_error. STACK_FULL if all nodes of the pool are used.
+ */
+stack_error_t concurrent_stack_push (concurrent_stack_t *stack,
+		const void *pushed_value);
+
+
+/*! This function returns the value from the top of the stack
+ *  and deletes it. Canaries and checksum of the node are checked.
+ *
+ * @param[in,out] stack - pointer to the stack.
+ * @param[out] result   - pointer to memory where the result will be written.
+ *
+ * @return stack_error
+ */
+stack_error_t concurrent_stack_pop (concurrent_stack_t *stack, void *result);
+
+
+#if ELIMINATION == ON
+
+/*! This function changes the elimination array of the stack.
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *  @param[in] size      - number of slots, 0 disables elimination.
+ *  @param[in] spin      - number of spins for which push or pop
+ *                         waits for a partner.
+ *
+ *  @return stack_error
+ *
+ *  @note No other thread may use the stack during this call.
+ */
+stack_error_t concurrent_stack_set_elimination (concurrent_stack_t *stack,
+		size_t size, unsigned spin);
+
+#else
+
+#define concurrent_stack_set_elimination(STACK_, SIZE_, SPIN_) STACK_OK
+
+#endif
+
+
+
+
+/*================== Functional macros ===================*/
+
+
+/*! This macro creates concurrent stack on heap
+ *  for CAPACITY_ elements.
+ *
+ */
+#define concurrent_stack_create(NAME_, TYPE_, CAPACITY_) \
+	concurrent_stack_t *NAME_ = concurrent_stack_create_func_(#NAME_,\
+			sizeof(TYPE_), CAPACITY_)
+
+
+/*! This macro returns the number of elements in the stack.
+ *  The value can be out of date if other threads change the stack.
+ *
+ * @param[in] STACK_ - pointer to the stack.
+ *
+ * @return number of elements in the stack.
+ */
+#define concurrent_stack_size(STACK_) \
+	atomic_load_explicit(&(STACK_)->size, memory_order_relaxed)
+
+
+/*! This macro returns the max number of elements in the stack.
+ *
+ * @param[in] STACK_ - pointer to the stack.
+ *
+ * @return capacity of the stack.
+ */
+#define concurrent_stack_capacity(STACK_) (STACK_)->capacity
+
+
+/*! This macro checks the stack for integrity.
+ *
+ * @param[in] STACK_ - stack to be checked.
+ *
+ * @return stack_error
+ */
+#define concurrent_stack_check(STACK_) \
+	concurrent_stack_check_func_(STACK_, _CURRENT_CODE_POSITION_)
+
+
+#endif
@@ -9,10 +9,217 @@
 /*================= Connecting headers ==================*/
 
 
+#include "../config/secure_stack.config.h"
 #include "others.h"
 #include "logging.h"
 #include "hash.h"
 
+#include <string.h>
+
+#if HASH_SIMD == ON && (defined(__x86_64__) || defined(__i386__))
+	#define HASH_X86_KERNELS_
+	#include <immintrin.h>
+#endif
+
+
+
+
+/*================== Local constants =====================*/
+
+
+/* Keys and primes are shared with the inline version in hash.h. */
+#define STRIPE_LANES      HASH_STRIPE_LANES_
+#define STRIPE_SIZE       HASH_STRIPE_SIZE_
+#define STRIPES_PER_BLOCK HASH_STRIPES_PER_BLOCK_
+#define BLOCK_SIZE        (STRIPES_PER_BLOCK * STRIPE_SIZE)
+
+#define PRIME32   HASH_PRIME32_
+
+#define SCRAMBLE_KEY_    (HASH_KEY_ + STRIPES_PER_BLOCK - 1)
+#define LAST_STRIPE_KEY_ HASH_LAST_STRIPE_KEY_
+
+
+
+
+/*========================= Types ========================*/
+
+
+typedef struct hash_kernel_t_
+{
+	void (*accumulate) (uint64_t *acc, const unsigned char *data,
+			size_t stripes, const uint64_t *key);
+	void (*scramble)   (uint64_t *acc, const uint64_t *key);
+} hash_kernel_t;
+
+
+
+
+/*=================== Local variables ====================*/
+
+
+/* Kernel of fast_hash64, it is selected on the first call. */
+static const hash_kernel_t *_HASH_KERNEL_ = NULL;
+
+
+
+
+/*==================== Local functions ===================*/
+
+
+static void accumulate_scalar (uint64_t *acc, const unsigned char *data,
+		size_t stripes, const uint64_t *key)
+{
+	for (size_t n = 0; n < stripes; ++n, data += STRIPE_SIZE)
+		hash64_accumulate_stripe_(acc, data, key + n);
+}
+
+
+static void scramble_scalar (uint64_t *acc, const uint64_t *key)
+{
+	for (size_t i = 0; i < STRIPE_LANES; ++i)
+	{
+		acc[i] ^= acc[i] >> 47;
+		acc[i] ^= key[i];
+		acc[i] *= PRIME32;
+	}
+}
+
+
+#ifdef HASH_X86_KERNELS_
+
+__attribute__((target("sse2")))
+static void accumulate_sse2 (uint64_t *acc, const unsigned char *data,
+		size_t stripes, const uint64_t *key)
+{
+	__m128i *acc_vec = (__m128i *) acc;
+
+	for (size_t n = 0; n < stripes; ++n, data += STRIPE_SIZE)
+	{
+		for (size_t i = 0; i < STRIPE_SIZE / sizeof (__m128i); ++i)
+		{
+			__m128i value = _mm_loadu_si128(
+					(const __m128i *) data + i);
+			__m128i data_key = _mm_xor_si128(value, _mm_loadu_si128(
+					(const __m128i *) (key + n) + i));
+			__m128i product = _mm_mul_epu32(data_key,
+					_mm_srli_epi64(data_key, 32));
+			__m128i swapped = _mm_shuffle_epi32(value,
+					_MM_SHUFFLE(1, 0, 3, 2));
+
+			__m128i sum = _mm_add_epi64(_mm_loadu_si128(acc_vec + i),
+					_mm_add_epi64(product, swapped));
+			_mm_storeu_si128(acc_vec + i, sum);
+		}
+	}
+}
+
+
+__attribute__((target("sse2")))
+static void scramble_sse2 (uint64_t *acc, const uint64_t *key)
+{
+	__m128i *acc_vec = (__m128i *) acc;
+	const __m128i prime = _mm_set1_epi32((int) PRIME32);
+
+	for (size_t i = 0; i < STRIPE_SIZE / sizeof (__m128i); ++i)
+	{
+		__m128i value = _mm_loadu_si128(acc_vec + i);
+		value = _mm_xor_si128(value, _mm_srli_epi64(value, 47));
+		value = _mm_xor_si128(value, _mm_loadu_si128(
+				(const __m128i *) key + i));
+
+		__m128i low  = _mm_mul_epu32(value, prime);
+		__m128i high = _mm_mul_epu32(_mm_srli_epi64(value, 32), prime);
+		_mm_storeu_si128(acc_vec + i,
+				_mm_add_epi64(low, _mm_slli_epi64(high, 32)));
+	}
+}
+
+
+__attribute__((target("avx2")))
+static void accumulate_avx2 (uint64_t *acc, const unsigned char *data,
+		size_t stripes, const uint64_t *key)
+{
+	__m256i *acc_vec = (__m256i *) acc;
+	__m256i acc0 = _mm256_loadu_si256(acc_vec),
+	        acc1 = _mm256_loadu_si256(acc_vec + 1);
+
+	for (size_t n = 0; n < stripes; ++n, data += STRIPE_SIZE)
+	{
+		const __m256i *data_vec = (const __m256i *) data,
+		              *key_vec  = (const __m256i *) (key + n);
+
+		__m256i value0 = _mm256_loadu_si256(data_vec),
+		        value1 = _mm256_loadu_si256(data_vec + 1);
+		__m256i data_key0 = _mm256_xor_si256(value0,
+				_mm256_loadu_si256(key_vec));
+		__m256i data_key1 = _mm256_xor_si256(value1,
+				_mm256_loadu_si256(key_vec + 1));
+
+		acc0 = _mm256_add_epi64(acc0, _mm256_mul_epu32(data_key0,
+				_mm256_srli_epi64(data_key0, 32)));
+		acc1 = _mm256_add_epi64(acc1, _mm256_mul_epu32(data_key1,
+				_mm256_srli_epi64(data_key1, 32)));
+		acc0 = _mm256_add_epi64(acc0, _mm256_shuffle_epi32(value0,
+				_MM_SHUFFLE(1, 0, 3, 2)));
+		acc1 = _mm256_add_epi64(acc1, _mm256_shuffle_epi32(value1,
+				_MM_SHUFFLE(1, 0, 3, 2)));
+	}
+
+	_mm256_storeu_si256(acc_vec,     acc0);
+	_mm256_storeu_si256(acc_vec + 1, acc1);
+}
+
+
+__attribute__((target("avx2")))
+static void scramble_avx2 (uint64_t *acc, const uint64_t *key)
+{
+	__m256i *acc_vec = (__m256i *) acc;
+	const __m256i prime = _mm256_set1_epi32((int) PRIME32);
+
+	for (size_t i = 0; i < STRIPE_SIZE / sizeof (__m256i); ++i)
+	{
+		__m256i value = _mm256_loadu_si256(acc_vec + i);
+		value = _mm256_xor_si256(value, _mm256_srli_epi64(value, 47));
+		value = _mm256_xor_si256(value, _mm256_loadu_si256(
+				(const __m256i *) key + i));
+
+		__m256i low  = _mm256_mul_epu32(value, prime);
+		__m256i high = _mm256_mul_epu32(_mm256_srli_epi64(value, 32),
+				prime);
+		_mm256_storeu_si256(acc_vec + i,
+				_mm256_add_epi64(low, _mm256_slli_epi64(high, 32)));
+	}
+}
+
+#endif // HASH_X86_KERNELS_
+
+
+/* Returns NULL if the kernel isn't supported. */
+static const hash_kernel_t *find_hash_kernel (hash_kernel_id_t id)
+{
+	static const hash_kernel_t scalar = { accumulate_scalar, scramble_scalar };
+
+	#ifdef HASH_X86_KERNELS_
+
+		static const hash_kernel_t sse2 = { accumulate_sse2, scramble_sse2 },
+		                           avx2 = { accumulate_avx2, scramble_avx2 };
+
+		__builtin_cpu_init();
+		if ((id == HASH_KERNEL_AUTO || id == HASH_KERNEL_AVX2) &&
+		    __builtin_cpu_supports("avx2"))
+			return &avx2;
+		if ((id == HASH_KERNEL_AUTO || id == HASH_KERNEL_SSE2) &&
+		    __builtin_cpu_supports("sse2"))
+			return &sse2;
+
+	#endif // HASH_X86_KERNELS_
+
+	if (id == HASH_KERNEL_AUTO || id == HASH_KERNEL_SCALAR)
+		return &scalar;
+
+	return NULL;
+}
+
 
 
 
@@ -42,3 +249,62 @@ uint64_t pearson_hash64 (const void* data, size_t len)
 
 	return hash64;
 }
+
+
+uint64_t fast_hash64 (const void *data, size_t len)
+{
+	if (!len)
+		return 0;
+
+	if_log (is_bad_mem(data, len), ERROR)
+		return 0;
+
+	/* Threads may select the kernel at the same time,
+	 * all of them store the same pointer. */
+	const hash_kernel_t *selected = __atomic_load_n(&_HASH_KERNEL_,
+			__ATOMIC_RELAXED);
+	if (!selected)
+	{
+		selected = find_hash_kernel(HASH_KERNEL_AUTO);
+		__atomic_store_n(&_HASH_KERNEL_, selected, __ATOMIC_RELAXED);
+	}
+
+	uint64_t acc[STRIPE_LANES];
+	hash64_init_(acc);
+	const unsigned char *ptr = (const unsigned char *) data;
+
+	if (len < STRIPE_SIZE)
+	{
+		unsigned char stripe[STRIPE_SIZE] = { 0 };
+		memcpy(stripe, ptr, len);
+		selected->accumulate(acc, stripe, 1, LAST_STRIPE_KEY_);
+	}
+	else
+	{
+		size_t blocks = (len - 1) / BLOCK_SIZE;
+		for (size_t i = 0; i < blocks; ++i, ptr += BLOCK_SIZE)
+		{
+			selected->accumulate(acc, ptr, STRIPES_PER_BLOCK, HASH_KEY_);
+			selected->scramble(acc, SCRAMBLE_KEY_);
+		}
+
+		size_t stripes = (len - 1 - blocks * BLOCK_SIZE) / STRIPE_SIZE;
+		selected->accumulate(acc, ptr, stripes, HASH_KEY_);
+
+		selected->accumulate(acc, (const unsigned char *) data +
+				len - STRIPE_SIZE, 1, LAST_STRIPE_KEY_);
+	}
+
+	return hash64_finish_(acc, len);
+}
+
+
+bool set_hash_kernel (hash_kernel_id_t kernel)
+{
+	const hash_kernel_t *found = find_hash_kernel(kernel);
+	if (!found)
+		return false;
+
+	__atomic_store_n(&_HASH_KERNEL_, found, __ATOMIC_RELAXED);
+	return true;
+}
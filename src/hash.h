@@ -18,8 +18,66 @@
 /*================= Connecting headers ==================*/
 
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+
+
+
+
+/*====================== Constants =======================*/
+
+
+/* fast_hash64 processes memory by stripes of 8 64-bit lanes. */
+#define HASH_STRIPE_LANES_      8
+#define HASH_STRIPE_SIZE_       (HASH_STRIPE_LANES_ * sizeof (uint64_t))
+#define HASH_STRIPES_PER_BLOCK_ 16
+
+#define HASH_PRIME32_   0x9E3779B1U
+#define HASH_PRIME64_1_ 0x9E3779B185EBCA87ULL
+#define HASH_PRIME64_2_ 0xC2B2AE3D27D4EB4FULL
+
+
+/* Stripe n of a block is mixed with HASH_KEY_[n .. n + 7]. */
+static const uint64_t HASH_KEY_[HASH_STRIPES_PER_BLOCK_ +
+                                HASH_STRIPE_LANES_ - 1] =
+{
+	0xE9A74F47747731B6ULL, 0x7AD4E628D8FF4A16ULL, 0x396BC3F07C96F414ULL,
+	0x5F8B2B3AD1D03076ULL, 0x10064CC019E5758EULL, 0x7CB52A4E3529FE53ULL,
+	0x76AFF89458E1602CULL, 0x2ECAE4796A9BF06EULL, 0x4D6DD463ECA00558ULL,
+	0x8B14E511DD752A8BULL, 0xA314C3E9147DFEEEULL, 0x974C2E17FB7A66ADULL,
+	0x0D5BE21A7E3779FBULL, 0x477D75BB624D48B9ULL, 0xF4B2117128CD959EULL,
+	0x182E33A675977D1FULL, 0xE2B56264F8865FF2ULL, 0x580531F4C9BDA42DULL,
+	0x74BE6C258809847BULL, 0xCE0429C60782B0B2ULL, 0xCA71A8C2CDE311EAULL,
+	0xE5100B9481F46A17ULL, 0x3AB864E9935BE9C8ULL,
+};
+
+#define HASH_LAST_STRIPE_KEY_ (HASH_KEY_ + HASH_STRIPE_LANES_ - 1)
+
+
+
+
+/*========================= Types ========================*/
+
+
+/*! Type of functions which calculate 64-bit hash of memory.
+ *  All hashing algorithms from this file match it,
+ *  so they can be switched in the configuration.
+ */
+typedef uint64_t (*hash64_func_t) (const void *data, size_t len);
+
+
+/*! Implementations of fast_hash64.
+ *
+ */
+typedef enum hash_kernel_id_t_
+{
+	HASH_KERNEL_AUTO   = 0, /*!< the best one supported by the processor. */
+	HASH_KERNEL_SCALAR = 1, /*!< 64-bit words without SIMD.               */
+	HASH_KERNEL_SSE2   = 2, /*!< SSE2 instructions.                       */
+	HASH_KERNEL_AVX2   = 3, /*!< AVX2 instructions.                       */
+} hash_kernel_id_t;
 
 
 
@@ -38,4 +96,158 @@
 uint64_t pearson_hash64 (const void* data, size_t len);
 
 
+/*! This function implements fast hashing algorithm which processes
+ *  memory by 64-bit words in 8 independent lanes.
+ *
+ *  @param[in] data - pointer to hashing memory.
+ *  @param[in] len  - length of hashing memory.
+ *
+ *  @return hash value.
+ *
+ *  @note SSE2 or AVX2 implementation is chosen on the first call
+ *        depending on the processor if HASH_SIMD is ON,
+ *        set_hash_kernel() can choose another one.
+ *        All implementations return the same values.
+ */
+uint64_t fast_hash64 (const void *data, size_t len);
+
+
+/*! This function sets the implementation used by fast_hash64.
+ *  It is meant for benchmarks and tests.
+ *
+ *  @param[in] kernel - implementation of fast_hash64.
+ *
+ *  @return false if the implementation is switched off
+ *          by HASH_SIMD or not supported by the processor.
+ */
+bool set_hash_kernel (hash_kernel_id_t kernel);
+
+
+
+
+
+/*=================== Inline functions ===================*/
+
+
+/*! This function mixes bits of 64-bit value so that each bit
+ *  of the result depends on every bit of the argument.
+ *
+ *  @param[in] value - value to be mixed.
+ *
+ *  @return mixed value.
+ */
+static inline uint64_t hash64_mix (uint64_t value)
+{
+	value ^= value >> 30;
+	value *= 0xBF58476D1CE4E5B9ULL;
+	value ^= value >> 27;
+	value *= 0x94D049BB133111EBULL;
+	value ^= value >> 31;
+
+	return value;
+}
+
+
+static inline uint64_t hash64_read_ (const unsigned char *ptr)
+{
+	uint64_t value;
+	memcpy(&value, ptr, sizeof value);
+	return value;
+}
+
+
+static inline void hash64_init_ (uint64_t *acc)
+{
+	acc[0] = HASH_PRIME32_;
+	acc[1] = HASH_PRIME64_1_;
+	acc[2] = HASH_PRIME64_2_;
+	acc[3] = HASH_PRIME64_1_ ^ HASH_PRIME64_2_;
+	acc[4] = HASH_PRIME64_2_;
+	acc[5] = HASH_PRIME32_;
+	acc[6] = HASH_PRIME64_1_;
+	acc[7] = HASH_PRIME64_1_ + HASH_PRIME64_2_;
+}
+
+
+static inline __attribute__((always_inline))
+void hash64_accumulate_stripe_ (uint64_t *acc, const unsigned char *data,
+		const uint64_t *key)
+{
+	for (size_t i = 0; i < HASH_STRIPE_LANES_; ++i)
+	{
+		uint64_t value    = hash64_read_(data + i * sizeof value);
+		uint64_t data_key = value ^ key[i];
+
+		acc[i ^ 1] += value;
+		acc[i]     += (data_key & 0xFFFFFFFFU) * (data_key >> 32);
+	}
+}
+
+
+static inline uint64_t hash64_fold_ (uint64_t lhs, uint64_t rhs)
+{
+	unsigned __int128 product = (unsigned __int128) lhs * rhs;
+	return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+
+static inline __attribute__((always_inline))
+uint64_t hash64_finish_ (const uint64_t *acc, size_t len)
+{
+	uint64_t hash = len * HASH_PRIME64_1_;
+	for (size_t i = 0; i < HASH_STRIPE_LANES_; i += 2)
+		hash += hash64_fold_(acc[i]     ^ HASH_KEY_[i],
+		                     acc[i + 1] ^ HASH_KEY_[i + 1]);
+
+	return hash64_mix(hash);
+}
+
+
+/* Memory of 1 to HASH_STRIPE_SIZE_ bytes is one stripe
+ * padded with zeros. */
+static inline __attribute__((always_inline))
+uint64_t fast_hash64_short_ (const void *data, size_t len)
+{
+	uint64_t acc[HASH_STRIPE_LANES_];
+	hash64_init_(acc);
+
+	unsigned char stripe[HASH_STRIPE_SIZE_] = { 0 };
+	memcpy(stripe, data, len);
+	hash64_accumulate_stripe_(acc, stripe, HASH_LAST_STRIPE_KEY_);
+
+	return hash64_finish_(acc, len);
+}
+
+
+/*! This function returns the same value as fast_hash64.
+ *  Memory up to 64 bytes is hashed inline, so the compiler can
+ *  unroll the hashing if the length is known at compile time.
+ *
+ *  @param[in] data - pointer to hashing memory.
+ *  @param[in] len  - length of hashing memory.
+ *
+ *  @return hash value.
+ *
+ *  @note Unlike fast_hash64 memory up to 64 bytes isn't checked,
+ *        so it must be readable.
+ */
+static inline __attribute__((always_inline))
+uint64_t fast_hash64_inline (const void *data, size_t len)
+{
+	if (len == 0 || len > HASH_STRIPE_SIZE_)
+		return fast_hash64(data, len);
+
+	return fast_hash64_short_(data, len);
+}
+
+
+/*! This function is pearson_hash64. It exists, so every
+ *  HASH_FUNCTION has the version with _inline suffix.
+ */
+static inline uint64_t pearson_hash64_inline (const void *data, size_t len)
+{
+	return pearson_hash64(data, len);
+}
+
+
 #endif
@@ -12,6 +12,8 @@
 /*================= Connecting headers ==================*/
 
 
+#define _GNU_SOURCE
+
 #include "logging.h"
 
 
@@ -19,187 +21,1416 @@
 
 
 #include "others.h"
+#include "binary_log.h"
 
 #include <execinfo.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#if ASYNC_LOGGING == ON
+
+#include <errno.h>
+#include <sched.h>
+#include <semaphore.h>
+
+#if LOG_QUEUE_SIZE < 2 || (LOG_QUEUE_SIZE & (LOG_QUEUE_SIZE - 1)) != 0
+	#error "LOG_QUEUE_SIZE must be a power of two"
+#endif
+
+#endif // ASYNC_LOGGING == ON
+
+
+
+
+/*========================= Types ========================*/
+
+
+/* Header of a record in the sublog arena.
+ * It is followed by msg and data strings with terminating zeros. */
+typedef struct log_t_
+{
+	danger_status_t danger;
+	int             deep_lvl;
+	size_t          msg_length;
+	size_t          data_length;
+} log_t;
+
+
+struct _SUBLOG_T_
+{
+	char           *arena;
+	size_t          arena_size;
+	size_t          used;
+	size_t          count;
+	danger_status_t danger;
+	const char     *fname;
+	const char     *func;
+	int             line;
+	bool            suppressed; /* Position of the multilog is rate limited. */
+};
+
+
+#if ASYNC_LOGGING == ON
+
+/* Slot of the async logging queue. Its sequence number tells
+ * whether the slot is free for the producer with the same position
+ * or is filled for the writer (sequence = position + 1).
+ * A multilog takes one slot with a copy of its records. */
+typedef struct log_message_t_
+{
+	atomic_size_t   sequence;
+	bool            stop;
+	danger_status_t danger;
+	int             deep_lvl;
+	const char     *fname;
+	const char     *func;
+	int             line;
+	uint64_t        timestamp;
+	int             stack_trace_size;
+	void           *stack_trace[MAX_STACK_TRACE_DEPTH];
+	char            msg [MAX_LOGGING_STRING_LENGTH];
+	char            data[MAX_LOGGING_STRING_LENGTH];
+	char           *sublogs;
+	size_t          sublog_count;
+} log_message_t;
+
+
+/* Bounded multi-producer single-consumer queue drained by
+ * the writer thread. The semaphore counts published records.
+ * Producers are counted, so the queue isn't freed while
+ * somebody writes to it. */
+struct _LOG_QUEUE_T_
+{
+	log_message_t        *slots;
+	_Alignas(64)
+	atomic_size_t         tail;
+	_Alignas(64)
+	size_t                head;
+	atomic_size_t         dropped;
+	size_t                reported;
+	_Atomic log_overflow_t overflow;
+	sem_t                 items;
+	pthread_t             writer;
+	atomic_bool           running;
+	atomic_size_t         producers;
+};
+
+#endif // ASYNC_LOGGING == ON
+
+
+/* Code position interned for the binary log. */
+typedef struct log_position_t_
+{
+	const char *fname;
+	const char *func;
+	int         line;
+	uint32_t    id;
+} log_position_t;
+
+
+/* Open addressing table of code positions which
+ * are already defined in the binary log file. */
+struct _LOG_POSITIONS_T_
+{
+	log_position_t *table;
+	size_t          capacity;
+	size_t          count;
+};
+
+
+#if LOG_RATE_LIMIT == ON
+
+/* Rate limit state of a code position. */
+typedef struct log_rate_t_
+{
+	const char *fname;
+	const char *func;
+	int         line;
+	uint64_t    window_start;
+	size_t      count;      /* Logs written in the current window. */
+	size_t      suppressed; /* Logs suppressed since the last summary. */
+} log_rate_t;
+
+
+/* Open addressing table of rate limited code positions. */
+struct _LOG_RATES_T_
+{
+	log_rate_t *table;
+	size_t      capacity;
+	size_t      count;
+	uint64_t    window; /* In nanoseconds. */
+	size_t      burst;
+	pthread_mutex_t lock;
+};
+
+#endif // LOG_RATE_LIMIT == ON
+
+
+#if STACK_TRACE == ON
+
+/* Symbolized return address. */
+typedef struct log_symbol_t_
+{
+	void *address;
+	char *symbol;
+	bool  in_binary; /* Frame is defined in the binary log file. */
+} log_symbol_t;
+
+
+/* Open addressing cache of symbolized return addresses. */
+struct _LOG_SYMBOLS_T_
+{
+	log_symbol_t *table;
+	size_t        capacity;
+	size_t        count;
+};
+
+#endif // STACK_TRACE == ON
+
+
+/* Sinks are changed and written under the lock, so records
+ * from different threads aren't mixed. The lock also guards
+ * the tables of positions and symbols used while writing.
+ * It is recursive to keep the records of a multilog together. */
+struct _LOG_STATUS_T_
+{
+	FILE            *file;
+	FILE            *binary_file;
+	bool             log_stdout;
+	bool             log_stderr;
+	atomic_bool      log_started;
+	pthread_mutex_t  lock;
+};
+
+
+
+
+/*=================== Local variables ====================*/
+
+
+_Atomic danger_status_t _LOG_LEVEL_ = MIN_LOG_LEVEL;
+
+
+/* Every thread collects its own multilog. */
+static _Thread_local struct _SUBLOG_T_ _SUBLOG_ =
+{
+	NULL,
+	0,
+	0,
+	0,
+	EMPTY,
+	NULL,
+	NULL,
+	0,
+	false,
+};
+
+
+static struct _LOG_STATUS_T_ _LOG_STATUS_ =
+{
+	NULL,
+	NULL,
+	false,
+	false,
+	false,
+	PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP,
+};
+
+
+/* Frees multilog arenas of finished threads. */
+static pthread_key_t  _SUBLOG_KEY_;
+static pthread_once_t _SUBLOG_KEY_ONCE_ = PTHREAD_ONCE_INIT;
+
+
+static struct _LOG_POSITIONS_T_ _LOG_POSITIONS_ =
+{
+	NULL,
+	0,
+	0,
+};
+
+
+#if LOG_RATE_LIMIT == ON
+
+static struct _LOG_RATES_T_ _LOG_RATES_ =
+{
+	NULL,
+	0,
+	0,
+	(uint64_t) LOG_RATE_WINDOW * 1000000,
+	LOG_RATE_BURST,
+	PTHREAD_MUTEX_INITIALIZER,
+};
+
+#endif // LOG_RATE_LIMIT == ON
+
+
+#if STACK_TRACE == ON
+
+static struct _LOG_SYMBOLS_T_ _LOG_SYMBOLS_ =
+{
+	NULL,
+	0,
+	0,
+};
+
+#endif // STACK_TRACE == ON
+
+
+#if ASYNC_LOGGING == ON
+
+static struct _LOG_QUEUE_T_ _LOG_QUEUE_ =
+{
+	.overflow = DEFAULT_LOG_OVERFLOW,
+};
+
+#endif // ASYNC_LOGGING == ON
+
+
+
+
+/*==================== Local functions ===================*/
+
+
+static inline bool log_is_started (void)
+{
+	return atomic_load_explicit(&_LOG_STATUS_.log_started,
+			memory_order_relaxed);
+}
+
+
+static inline void fput_nchars (char ch, int n, FILE* fp)
+{
+	for (int i = 0; i < n; ++i)
+		fputc(ch, fp);
+}
+
+
+#if STACK_TRACE == ON
+
+static inline size_t log_symbol_index (const void *address, size_t capacity)
+{
+	uint64_t key = (uint64_t) (uintptr_t) address * 0x9E3779B97F4A7C15ULL;
+	key ^= key >> 29;
+	return (size_t) key & (capacity - 1);
+}
+
+
+static bool grow_log_symbols (void)
+{
+	size_t new_capacity = _LOG_SYMBOLS_.capacity ?
+	                      _LOG_SYMBOLS_.capacity * 2 : 256;
+	log_symbol_t *new_table = (log_symbol_t *) calloc(new_capacity,
+			sizeof *new_table);
+	if (!new_table)
+		return false;
+
+	for (size_t i = 0; i < _LOG_SYMBOLS_.capacity; ++i)
+	{
+		log_symbol_t *symbol = &_LOG_SYMBOLS_.table[i];
+		if (!symbol->address)
+			continue;
+
+		size_t index = log_symbol_index(symbol->address, new_capacity);
+		while (new_table[index].address)
+			index = (index + 1) & (new_capacity - 1);
+		new_table[index] = *symbol;
+	}
+
+	free(_LOG_SYMBOLS_.table);
+	_LOG_SYMBOLS_.table    = new_table;
+	_LOG_SYMBOLS_.capacity = new_capacity;
+
+	return true;
+}
+
+
+static void free_log_symbols (void)
+{
+	for (size_t i = 0; i < _LOG_SYMBOLS_.capacity; ++i)
+		free(_LOG_SYMBOLS_.table[i].symbol);
+
+	free(_LOG_SYMBOLS_.table);
+	_LOG_SYMBOLS_.table    = NULL;
+	_LOG_SYMBOLS_.capacity = 0;
+	_LOG_SYMBOLS_.count    = 0;
+}
+
+
+/* Returns cached symbol of the address. Address is symbolized
+ * only the first time it is met. Returns NULL if there is no memory. */
+static log_symbol_t *find_log_symbol (void *address)
+{
+	if ((_LOG_SYMBOLS_.count + 1) * 2 > _LOG_SYMBOLS_.capacity &&
+			!grow_log_symbols())
+		return NULL;
+
+	size_t index = log_symbol_index(address, _LOG_SYMBOLS_.capacity);
+	while (_LOG_SYMBOLS_.table[index].address)
+	{
+		if (_LOG_SYMBOLS_.table[index].address == address)
+			return &_LOG_SYMBOLS_.table[index];
+		index = (index + 1) & (_LOG_SYMBOLS_.capacity - 1);
+	}
+
+	char **symbols = backtrace_symbols(&address, 1);
+	char *symbol = symbols ? strdup(symbols[0]) : NULL;
+	free(symbols);
+	if (!symbol)
+		return NULL;
+
+	_LOG_SYMBOLS_.table[index] = (log_symbol_t) { address, symbol, false };
+	_LOG_SYMBOLS_.count++;
+
+	return &_LOG_SYMBOLS_.table[index];
+}
+
+
+static int print_stack_trace (void *const stack_trace[], int size, FILE *fp)
+{
+	int printed = fputs("============> STACK TRACE <=============\n", fp);
+	for (int i = 0; i < size; ++i)
+	{
+		log_symbol_t *symbol = find_log_symbol(stack_trace[i]);
+		if (symbol)
+			printed += fputs(symbol->symbol, fp);
+		else
+			printed += fprintf(fp, "[%p]", stack_trace[i]);
+		fputc('\n', fp);
+	}
+	fputc('\n', fp);
+	return printed;
+}
+
+#endif // STACK_TRACE == ON
+
+
+static bool fprint_log_ (FILE *fp, const char *msg, const char *data,
+		const char *danger_str, int deep_lvl, _CODE_POSITION_T_,
+		void *const stack_trace[], int stack_trace_size)
+{
+	int printed = -1;
+
+	fput_nchars('\t', deep_lvl, fp);
+	if (deep_lvl == 0)
+		printed = fprintf(fp, "%s In %s: %s():%d: %s\n",
+				danger_str, fname, func, line, msg);
+	else
+		printed = fprintf(fp, "%s %s\n", danger_str, msg);
+
+
+	fput_nchars('\t', deep_lvl, fp);
+	printed += fputs(data, fp);
+	fputc('\n', fp);
+	fputc('\n', fp);
+
+	#if STACK_TRACE == ON
+		if (deep_lvl == 0)
+		{
+			printed += print_stack_trace(stack_trace,
+					stack_trace_size, fp);
+		}
+	#else
+		(void) stack_trace;
+		(void) stack_trace_size;
+	#endif // STACK_TRACE == ON
+
+	fputc('\n', fp);
+
+	return printed > 0;
+}
+
+
+#if STACK_TRACE == ON
+
+/* Captures only return addresses, they are symbolized when the log
+ * is written. Frames of this function and write_log_at are skipped,
+ * so are two outermost frames if the whole stack fits. */
+static __attribute__((noinline)) int get_stack_trace (void *stack_trace[])
+{
+	enum { SKIPPED = 2, BUF_SIZE = MAX_STACK_TRACE_DEPTH + SKIPPED };
+	void *buffer[BUF_SIZE];
+
+	int size = backtrace(buffer, BUF_SIZE);
+	if (size < BUF_SIZE)
+		size -= 2;
+	size -= SKIPPED;
+	if (size <= 0)
+		return 0;
+
+	memcpy(stack_trace, buffer + SKIPPED, size * sizeof *buffer);
+	return size;
+}
+
+#endif // STACK_TRACE == ON
+
+
+static void gen_danger_str (char danger_str[], danger_status_t danger,
+		            bool colorful)
+{
+	switch ( danger )
+	{
+		case EMPTY:
+			strcpy(danger_str, "");
+			break;
+		case OK:
+			if (colorful)
+				strcpy(danger_str, "\033[1;32m[OK]:\033[0m");
+			else
+				strcpy(danger_str,           "[OK]:");
+			break;
+
+		case WARNING:
+			if (colorful)
+				strcpy(danger_str, "\033[1;33m==> WARNING:\033[0m");
+			else
+				strcpy(danger_str,           "==> WARNING:");
+			break;
+
+		case ERROR:
+			if (colorful)
+				strcpy(danger_str, "\033[1;31m!!! ERROR:\033[0m");
+			else	
+				strcpy(danger_str,           "!!! ERROR:");
+			break;
+		default:
+			strcpy(danger_str, "--> UNKNOWN:");
+	}
+}
+
+
+static inline uint64_t log_timestamp (void)
+{
+	struct timespec time = {};
+	clock_gettime(CLOCK_REALTIME, &time);
+	return (uint64_t) time.tv_sec * 1000000000 + (uint64_t) time.tv_nsec;
+}
+
+
+static inline size_t log_position_index (const char *fname,
+		const char *func, int line, size_t capacity)
+{
+	uint64_t key = (uint64_t) (uintptr_t) fname * 0x9E3779B97F4A7C15ULL ^
+	               (uint64_t) (uintptr_t) func  * 0xC2B2AE3D27D4EB4FULL ^
+	               (uint64_t) line;
+	key ^= key >> 29;
+	return (size_t) key & (capacity - 1);
+}
+
+
+static bool grow_log_positions (void)
+{
+	size_t new_capacity = _LOG_POSITIONS_.capacity ?
+	                      _LOG_POSITIONS_.capacity * 2 : 64;
+	log_position_t *new_table = (log_position_t *) calloc(new_capacity,
+			sizeof *new_table);
+	if (!new_table)
+		return false;
+
+	for (size_t i = 0; i < _LOG_POSITIONS_.capacity; ++i)
+	{
+		log_position_t *pos = &_LOG_POSITIONS_.table[i];
+		if (!pos->fname)
+			continue;
+
+		size_t index = log_position_index(pos->fname, pos->func,
+				pos->line, new_capacity);
+		while (new_table[index].fname)
+			index = (index + 1) & (new_capacity - 1);
+		new_table[index] = *pos;
+	}
+
+	free(_LOG_POSITIONS_.table);
+	_LOG_POSITIONS_.table    = new_table;
+	_LOG_POSITIONS_.capacity = new_capacity;
+
+	return true;
+}
+
+
+static void reset_log_positions (void)
+{
+	free(_LOG_POSITIONS_.table);
+	_LOG_POSITIONS_.table    = NULL;
+	_LOG_POSITIONS_.capacity = 0;
+	_LOG_POSITIONS_.count    = 0;
+}
+
+
+static bool write_binary_position (FILE *fp, const log_position_t *pos)
+{
+	binlog_position_t record =
+	{
+		.type         = BINLOG_POSITION,
+		.id           = pos->id,
+		.line         = (uint32_t) pos->line,
+		.fname_length = (uint32_t) strlen(pos->fname),
+		.func_length  = (uint32_t) strlen(pos->func),
+	};
+
+	return fwrite(&record, sizeof record, 1, fp) == 1 &&
+	       fwrite(pos->fname, 1, record.fname_length, fp) ==
+	              record.fname_length &&
+	       fwrite(pos->func,  1, record.func_length,  fp) ==
+	              record.func_length;
+}
+
+
+/* Returns id of the code position. New positions are
+ * defined in the binary log file before their first use.
+ * Positions are compared by pointers to their strings. */
+static bool get_log_position_id (FILE *fp, _CODE_POSITION_T_, uint32_t *id)
+{
+	if (!fname)
+		fname = "";
+	if (!func)
+		func = "";
+
+	if ((_LOG_POSITIONS_.count + 1) * 2 > _LOG_POSITIONS_.capacity &&
+			!grow_log_positions())
+		return false;
+
+	size_t index = log_position_index(fname, func, line,
+			_LOG_POSITIONS_.capacity);
+	for (;;)
+	{
+		log_position_t *pos = &_LOG_POSITIONS_.table[index];
+		if (!pos->fname)
+			break;
+		if (pos->fname == fname && pos->func == func && pos->line == line)
+		{
+			*id = pos->id;
+			return true;
+		}
+		index = (index + 1) & (_LOG_POSITIONS_.capacity - 1);
+	}
+
+	log_position_t *pos = &_LOG_POSITIONS_.table[index];
+	*pos = (log_position_t) { fname, func, line,
+	                          (uint32_t) _LOG_POSITIONS_.count };
+	_LOG_POSITIONS_.count++;
+
+	*id = pos->id;
+	return write_binary_position(fp, pos);
+}
+
+
+#if STACK_TRACE == ON
+
+/* Defines symbols of return addresses which aren't
+ * defined in the binary log file yet. */
+static bool write_binary_frames (FILE *fp,
+		void *const stack_trace[], int stack_trace_size)
+{
+	for (int i = 0; i < stack_trace_size; ++i)
+	{
+		log_symbol_t *symbol = find_log_symbol(stack_trace[i]);
+		if (!symbol || symbol->in_binary)
+			continue;
+
+		binlog_frame_t record =
+		{
+			.type          = BINLOG_FRAME,
+			.symbol_length = (uint32_t) strlen(symbol->symbol),
+			.address       = (uint64_t) (uintptr_t) symbol->address,
+		};
+
+		if (fwrite(&record, sizeof record, 1, fp) != 1 ||
+				fwrite(symbol->symbol, 1, record.symbol_length, fp) !=
+				record.symbol_length)
+			return false;
+
+		symbol->in_binary = true;
+	}
+	return true;
+}
+
+#endif // STACK_TRACE == ON
+
+
+static bool fprint_binary_log_ (FILE *fp, const char *msg, const char *data,
+		danger_status_t danger, int deep_lvl, _CODE_POSITION_T_,
+		uint64_t timestamp, void *const stack_trace[], int stack_trace_size)
+{
+	binlog_entry_t entry =
+	{
+		.type        = BINLOG_ENTRY,
+		.danger      = (uint8_t) danger,
+		.deep_lvl    = (uint16_t) deep_lvl,
+		.timestamp   = timestamp,
+		.msg_length  = (uint32_t) strlen(msg),
+		.data_length = (uint32_t) strlen(data),
+	};
+
+	if (!get_log_position_id(fp, _CODE_POSITION_, &entry.position))
+		return false;
+
+	#if STACK_TRACE == ON
+		if (deep_lvl == 0)
+		{
+			entry.flags |= BINLOG_HAS_TRACE;
+			entry.trace_depth = (uint32_t) stack_trace_size;
+			if (!write_binary_frames(fp, stack_trace, stack_trace_size))
+				return false;
+		}
+	#else
+		(void) stack_trace;
+		(void) stack_trace_size;
+	#endif // STACK_TRACE == ON
+
+	bool success = fwrite(&entry, sizeof entry, 1, fp) == 1 &&
+	       fwrite(msg,  1, entry.msg_length,  fp) == entry.msg_length &&
+	       fwrite(data, 1, entry.data_length, fp) == entry.data_length;
+
+	#if STACK_TRACE == ON
+		for (uint32_t i = 0; success && i < entry.trace_depth; ++i)
+		{
+			uint64_t address = (uint64_t) (uintptr_t) stack_trace[i];
+			success = fwrite(&address, sizeof address, 1, fp) == 1;
+		}
+	#endif // STACK_TRACE == ON
+
+	return success;
+}
+
+
+/* Writes one record to all sinks. */
+static void write_log_record (const char *msg, const char *data,
+		danger_status_t danger, int deep_lvl, _CODE_POSITION_T_,
+		uint64_t timestamp, void *const stack_trace[], int stack_trace_size,
+		bool flush)
+{
+	bool logging_success = true;
+
+	char danger_str[25];
+
+	pthread_mutex_lock(&_LOG_STATUS_.lock);
+
+	if (_LOG_STATUS_.binary_file)
+	{
+		logging_success &= fprint_binary_log_(_LOG_STATUS_.binary_file,
+				msg, data, danger, deep_lvl, _CODE_POSITION_,
+				timestamp, stack_trace, stack_trace_size);
+		if (flush)
+			fflush(_LOG_STATUS_.binary_file);
+	}
+
+	if (_LOG_STATUS_.file)
+	{
+		gen_danger_str(danger_str, danger, false);
+		logging_success &= fprint_log_(_LOG_STATUS_.file, msg, data,
+				danger_str, deep_lvl, fname, func, line,
+				stack_trace, stack_trace_size);
+		if (flush)
+			fflush(_LOG_STATUS_.file);
+	}
+
+	if (_LOG_STATUS_.log_stdout)
+	{
+		gen_danger_str(danger_str, danger, true);
+		logging_success &= fprint_log_(stdout, msg, data,
+				danger_str, deep_lvl, fname, func, line,
+				stack_trace, stack_trace_size);
+	}
+
+	if (_LOG_STATUS_.log_stderr)
+	{
+		gen_danger_str(danger_str, danger, true);
+		logging_success &= fprint_log_(stderr, msg, data,
+				danger_str, deep_lvl, fname, func, line,
+				stack_trace, stack_trace_size);
+	}
+
+	pthread_mutex_unlock(&_LOG_STATUS_.lock);
+
+	if (!logging_success)
+	{
+		perror("Logging failed!!!\n"
+				"The program was interrupted.");
+		abort();
+	}
+}
+
+
+static size_t log_record_size (const log_t *record)
+{
+	size_t size = sizeof *record + record->msg_length + record->data_length;
+	return (size + _Alignof(log_t) - 1) & ~(_Alignof(log_t) - 1);
+}
+
+
+static log_t *next_log_record (log_t *record)
+{
+	return (log_t *) ((char *) record + log_record_size(record));
+}
+
+
+static const char *log_record_msg (const log_t *record)
+{
+	return (const char *) (record + 1);
+}
+
+
+static const char *log_record_data (const log_t *record)
+{
+	return log_record_msg(record) + record->msg_length;
+}
+
+
+/* Writes records of a multilog under the lock, so records
+ * of other threads don't get between them. The header is
+ * written with the max danger of the multilog. */
+static void write_sublog_records (const char *arena, size_t count,
+		danger_status_t danger, _CODE_POSITION_T_, uint64_t timestamp,
+		void *const stack_trace[], int stack_trace_size, bool flush)
+{
+	pthread_mutex_lock(&_LOG_STATUS_.lock);
+
+	log_t *record = (log_t *) arena;
+	for (size_t log = 0; log < count; ++log)
+	{
+		write_log_record(log_record_msg(record), log_record_data(record),
+				log == 0 ? danger : record->danger, record->deep_lvl,
+				_CODE_POSITION_, timestamp, stack_trace,
+				record->deep_lvl == 0 ? stack_trace_size : 0, flush);
+		record = next_log_record(record);
+	}
+
+	pthread_mutex_unlock(&_LOG_STATUS_.lock);
+}
+
+
+#if ASYNC_LOGGING == ON
+
+static inline log_message_t *log_queue_slot (size_t pos)
+{
+	return &_LOG_QUEUE_.slots[pos & (LOG_QUEUE_SIZE - 1)];
+}
+
+
+/* Takes a free slot for the producer or returns NULL if
+ * the queue is full. Position of the slot is written to pos. */
+static log_message_t *reserve_log_slot (size_t *pos)
+{
+	size_t tail = atomic_load_explicit(&_LOG_QUEUE_.tail,
+			memory_order_relaxed);
+	for (;;)
+	{
+		log_message_t *slot = log_queue_slot(tail);
+		size_t sequence = atomic_load_explicit(&slot->sequence,
+				memory_order_acquire);
+		intptr_t diff = (intptr_t) sequence - (intptr_t) tail;
+
+		if (diff == 0)
+		{
+			if (atomic_compare_exchange_weak_explicit(
+					&_LOG_QUEUE_.tail, &tail, tail + 1,
+					memory_order_relaxed, memory_order_relaxed))
+			{
+				*pos = tail;
+				return slot;
+			}
+		}
+		else if (diff < 0)
+			return NULL;
+		else
+			tail = atomic_load_explicit(&_LOG_QUEUE_.tail,
+					memory_order_relaxed);
+	}
+}
+
+
+/* Waits for a free slot if the policy says so or if the record
+ * must not be lost. Returns NULL if the records are dropped. */
+static log_message_t *acquire_log_slot (size_t *pos, bool must_block,
+		size_t records)
+{
+	log_message_t *slot = NULL;
+	while (!(slot = reserve_log_slot(pos)))
+	{
+		if (!must_block && atomic_load_explicit(&_LOG_QUEUE_.overflow,
+				memory_order_relaxed) != LOG_OVERFLOW_BLOCK)
+		{
+			atomic_fetch_add_explicit(&_LOG_QUEUE_.dropped, records,
+					memory_order_relaxed);
+			return NULL;
+		}
+		sched_yield();
+	}
+	return slot;
+}
+
+
+static void publish_log_slot (log_message_t *slot, size_t pos)
+{
+	atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+	sem_post(&_LOG_QUEUE_.items);
+}
+
+
+static void copy_log_string (char *dest, const char *src)
+{
+	size_t length = strlen(src);
+	if (length >= MAX_LOGGING_STRING_LENGTH)
+		length = MAX_LOGGING_STRING_LENGTH - 1;
+
+	memcpy(dest, src, length);
+	dest[length] = '\0';
+}
+
+
+static bool enqueue_log (const char *msg, const char *data,
+		danger_status_t danger, int deep_lvl, _CODE_POSITION_T_,
+		uint64_t timestamp, void *const stack_trace[], int stack_trace_size)
+{
+	size_t pos = 0;
+	log_message_t *slot = acquire_log_slot(&pos, false, 1);
+	if (!slot)
+		return false;
+
+	slot->stop             = false;
+	slot->sublogs          = NULL;
+	slot->danger           = danger;
+	slot->deep_lvl         = deep_lvl;
+	slot->fname            = fname;
+	slot->func             = func;
+	slot->line             = line;
+	slot->timestamp        = timestamp;
+	slot->stack_trace_size = stack_trace_size;
+	memcpy(slot->stack_trace, stack_trace,
+			stack_trace_size * sizeof *stack_trace);
+	copy_log_string(slot->msg,  msg);
+	copy_log_string(slot->data, data);
+
+	publish_log_slot(slot, pos);
+	return true;
+}
+
+
+/* The slot owns the copy of records, the writer frees it. */
+static bool enqueue_multilog (char *sublogs, size_t sublog_count,
+		danger_status_t danger, _CODE_POSITION_T_, uint64_t timestamp,
+		void *const stack_trace[], int stack_trace_size)
+{
+	size_t pos = 0;
+	log_message_t *slot = acquire_log_slot(&pos, false, sublog_count);
+	if (!slot)
+	{
+		free(sublogs);
+		return false;
+	}
+
+	slot->stop             = false;
+	slot->sublogs          = sublogs;
+	slot->sublog_count     = sublog_count;
+	slot->danger           = danger;
+	slot->fname            = fname;
+	slot->func             = func;
+	slot->line             = line;
+	slot->timestamp        = timestamp;
+	slot->stack_trace_size = stack_trace_size;
+	memcpy(slot->stack_trace, stack_trace,
+			stack_trace_size * sizeof *stack_trace);
+
+	publish_log_slot(slot, pos);
+	return true;
+}
+
+
+static void report_dropped_logs (void)
+{
+	size_t dropped = atomic_load_explicit(&_LOG_QUEUE_.dropped,
+			memory_order_relaxed);
+	if (dropped == _LOG_QUEUE_.reported)
+		return;
+
+	size_t not_reported = dropped - _LOG_QUEUE_.reported;
+	_LOG_QUEUE_.reported = dropped;
+
+	if (atomic_load_explicit(&_LOG_QUEUE_.overflow,
+			memory_order_relaxed) != LOG_OVERFLOW_COUNT)
+		return;
+
+	char str[64];
+	sprintf(str, "%zu records were dropped", not_reported);
+	write_log_record("Logging queue overflow!", str, WARNING, 0,
+			_CURRENT_CODE_POSITION_, log_timestamp(), NULL, 0, false);
+}
+
+
+static void *log_writer (void *arg)
+{
+	(void) arg;
+
+	for (bool stop = false; !stop; )
+	{
+		while (sem_wait(&_LOG_QUEUE_.items) == -1 && errno == EINTR)
+			;
+
+		/* Semaphore may be posted by a producer which took a later
+		 * slot, so wait for the head slot to be published. */
+		size_t head = _LOG_QUEUE_.head;
+		log_message_t *slot = log_queue_slot(head);
+		while (atomic_load_explicit(&slot->sequence,
+				memory_order_acquire) != head + 1)
+			sched_yield();
+
+		stop = slot->stop;
+		if (!stop && slot->sublogs)
+		{
+			write_sublog_records(slot->sublogs, slot->sublog_count,
+					slot->danger, slot->fname, slot->func, slot->line,
+					slot->timestamp, slot->stack_trace,
+					slot->stack_trace_size, false);
+			free(slot->sublogs);
+			slot->sublogs = NULL;
+		}
+		else if (!stop)
+			write_log_record(slot->msg, slot->data, slot->danger,
+					slot->deep_lvl, slot->fname, slot->func,
+					slot->line, slot->timestamp, slot->stack_trace,
+					slot->stack_trace_size, false);
+
+		atomic_store_explicit(&slot->sequence, head + LOG_QUEUE_SIZE,
+				memory_order_release);
+		_LOG_QUEUE_.head = head + 1;
+
+		report_dropped_logs();
+
+		/* Flush only when the queue is drained. */
+		int pending = 0;
+		sem_getvalue(&_LOG_QUEUE_.items, &pending);
+		if (pending == 0)
+		{
+			pthread_mutex_lock(&_LOG_STATUS_.lock);
+			if (_LOG_STATUS_.file)
+				fflush(_LOG_STATUS_.file);
+			if (_LOG_STATUS_.binary_file)
+				fflush(_LOG_STATUS_.binary_file);
+			pthread_mutex_unlock(&_LOG_STATUS_.lock);
+		}
+	}
+
+	return NULL;
+}
+
+
+static bool start_log_writer (void)
+{
+	_LOG_QUEUE_.slots = (log_message_t *) calloc(LOG_QUEUE_SIZE,
+			sizeof *_LOG_QUEUE_.slots);
+	if (!_LOG_QUEUE_.slots)
+		return false;
+
+	for (size_t i = 0; i < LOG_QUEUE_SIZE; ++i)
+		atomic_init(&_LOG_QUEUE_.slots[i].sequence, i);
+	atomic_init(&_LOG_QUEUE_.tail, 0);
+	_LOG_QUEUE_.head = 0;
+
+	if (sem_init(&_LOG_QUEUE_.items, 0, 0) != 0)
+	{
+		free(_LOG_QUEUE_.slots);
+		_LOG_QUEUE_.slots = NULL;
+		return false;
+	}
+
+	if (pthread_create(&_LOG_QUEUE_.writer, NULL, log_writer, NULL) != 0)
+	{
+		sem_destroy(&_LOG_QUEUE_.items);
+		free(_LOG_QUEUE_.slots);
+		_LOG_QUEUE_.slots = NULL;
+		return false;
+	}
+
+	atomic_store(&_LOG_QUEUE_.running, true);
+	return true;
+}
+
+
+/* Puts the stop record after all queued ones and waits
+ * until the writer thread writes them. New records are written
+ * synchronously, records of producers which have already seen
+ * the running writer are queued before the stop record. */
+static void stop_log_writer (void)
+{
+	bool running = true;
+	if (!atomic_compare_exchange_strong(&_LOG_QUEUE_.running, &running,
+			false))
+		return;
+
+	while (atomic_load(&_LOG_QUEUE_.producers) > 0)
+		sched_yield();
+
+	size_t pos = 0;
+	log_message_t *slot = acquire_log_slot(&pos, true, 1);
+	slot->stop = true;
+	publish_log_slot(slot, pos);
+
+	pthread_join(_LOG_QUEUE_.writer, NULL);
+
+	sem_destroy(&_LOG_QUEUE_.items);
+	free(_LOG_QUEUE_.slots);
+	_LOG_QUEUE_.slots = NULL;
+}
+
+#endif // ASYNC_LOGGING == ON
+
+
+/* Closes binary log file, the lock must be held. */
+static void close_binary_logfile (void)
+{
+	if (_LOG_STATUS_.binary_file)
+	{
+		fclose(_LOG_STATUS_.binary_file);
+		_LOG_STATUS_.binary_file = NULL;
+	}
+	reset_log_positions();
+
+	#if STACK_TRACE == ON
+		for (size_t i = 0; i < _LOG_SYMBOLS_.capacity; ++i)
+			_LOG_SYMBOLS_.table[i].in_binary = false;
+	#endif // STACK_TRACE == ON
+}
+
+
+static inline bool log_is_async (void)
+{
+	#if ASYNC_LOGGING == ON
+		return atomic_load_explicit(&_LOG_QUEUE_.running,
+				memory_order_relaxed);
+	#else
+		return false;
+	#endif // ASYNC_LOGGING == ON
+}
+
+
+#if ASYNC_LOGGING == ON
+
+/* stop_log_writer() clears running before it waits for producers,
+ * so either the record is queued before the stop record or it is
+ * written synchronously. Returns false if the writer is stopped. */
+static bool enter_log_queue (void)
+{
+	if (!atomic_load_explicit(&_LOG_QUEUE_.running, memory_order_relaxed))
+		return false;
+
+	atomic_fetch_add(&_LOG_QUEUE_.producers, 1);
+	if (atomic_load(&_LOG_QUEUE_.running))
+		return true;
+
+	atomic_fetch_sub_explicit(&_LOG_QUEUE_.producers, 1,
+			memory_order_release);
+	return false;
+}
+
+
+static void leave_log_queue (void)
+{
+	atomic_fetch_sub_explicit(&_LOG_QUEUE_.producers, 1,
+			memory_order_release);
+}
+
+#endif // ASYNC_LOGGING == ON
+
+
+/* Writes the entry to the queue in async mode or to sinks otherwise. */
+static void write_log_entry (const char *msg, const char *data,
+		danger_status_t danger, int deep_lvl, _CODE_POSITION_T_,
+		uint64_t timestamp, void *const stack_trace[], int stack_trace_size)
+{
+	#if ASYNC_LOGGING == ON
+		if (enter_log_queue())
+		{
+			enqueue_log(msg, data, danger, deep_lvl, _CODE_POSITION_,
+					timestamp, stack_trace, stack_trace_size);
+			leave_log_queue();
+			return;
+		}
+	#endif // ASYNC_LOGGING == ON
+
+	write_log_record(msg, data, danger, deep_lvl, _CODE_POSITION_,
+			timestamp, stack_trace, stack_trace_size, true);
+}
 
 
+/* In async mode the whole multilog is queued as one record,
+ * so the writer thread writes it without records of other threads.
+ * If the copy of records can't be allocated, it is written here. */
+static void write_multilog_entry (danger_status_t danger, _CODE_POSITION_T_,
+		uint64_t timestamp, void *const stack_trace[], int stack_trace_size)
+{
+	#if ASYNC_LOGGING == ON
+		if (log_is_async())
+		{
+			char *sublogs = (char *) malloc(_SUBLOG_.used);
+			if (sublogs)
+			{
+				memcpy(sublogs, _SUBLOG_.arena, _SUBLOG_.used);
+				if (enter_log_queue())
+				{
+					enqueue_multilog(sublogs, _SUBLOG_.count, danger,
+							_CODE_POSITION_, timestamp,
+							stack_trace, stack_trace_size);
+					leave_log_queue();
+					return;
+				}
+				free(sublogs);
+			}
+		}
+	#endif // ASYNC_LOGGING == ON
 
+	write_sublog_records(_SUBLOG_.arena, _SUBLOG_.count, danger,
+			_CODE_POSITION_, timestamp, stack_trace, stack_trace_size, true);
+}
 
-/*========================= Types ========================*/
 
+#if LOG_RATE_LIMIT == ON
 
-typedef struct log_t_
+static inline uint64_t log_monotonic_time (void)
 {
-	char            msg[MAX_LOGGING_STRING_LENGTH];
-	char            data[MAX_LOGGING_STRING_LENGTH];
-	danger_status_t danger;
-	int             deep_lvl;
-} log_t;
+	struct timespec time = {};
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t) time.tv_sec * 1000000000 + (uint64_t) time.tv_nsec;
+}
 
 
-struct _SUBLOG_T_
+static bool grow_log_rates (void)
 {
-	log_t      *logs;
-	size_t      count;
-	const char *fname;
-	const char *func;
-	int         line;
-};
+	size_t new_capacity = _LOG_RATES_.capacity ?
+	                      _LOG_RATES_.capacity * 2 : 64;
+	log_rate_t *new_table = (log_rate_t *) calloc(new_capacity,
+			sizeof *new_table);
+	if (!new_table)
+		return false;
+
+	for (size_t i = 0; i < _LOG_RATES_.capacity; ++i)
+	{
+		log_rate_t *rate = &_LOG_RATES_.table[i];
+		if (!rate->fname)
+			continue;
+
+		size_t index = log_position_index(rate->fname, rate->func,
+				rate->line, new_capacity);
+		while (new_table[index].fname)
+			index = (index + 1) & (new_capacity - 1);
+		new_table[index] = *rate;
+	}
 
+	free(_LOG_RATES_.table);
+	_LOG_RATES_.table    = new_table;
+	_LOG_RATES_.capacity = new_capacity;
 
-struct _LOG_STATUS_T_
+	return true;
+}
+
+
+/* Returns rate limit state of the position, NULL if there is no memory. */
+static log_rate_t *find_log_rate (_CODE_POSITION_T_)
 {
-	FILE *file;
-	bool  log_stdout;
-	bool  log_stderr;
-	bool  log_started;
-};
+	if (!fname)
+		fname = "";
+	if (!func)
+		func = "";
 
+	if ((_LOG_RATES_.count + 1) * 2 > _LOG_RATES_.capacity &&
+			!grow_log_rates())
+		return NULL;
 
+	size_t index = log_position_index(fname, func, line,
+			_LOG_RATES_.capacity);
+	while (_LOG_RATES_.table[index].fname)
+	{
+		log_rate_t *rate = &_LOG_RATES_.table[index];
+		if (rate->fname == fname && rate->func == func && rate->line == line)
+			return rate;
+		index = (index + 1) & (_LOG_RATES_.capacity - 1);
+	}
 
+	log_rate_t *rate = &_LOG_RATES_.table[index];
+	*rate = (log_rate_t) { fname, func, line, log_monotonic_time(), 0, 0 };
+	_LOG_RATES_.count++;
 
-/*=================== Local variables ====================*/
+	return rate;
+}
 
 
-static struct _SUBLOG_T_ _SUBLOG_ =
+static void write_log_rate_summary (log_rate_t *rate)
 {
-	NULL,
-	0,
-	NULL,
-	NULL,
-	0,
-};
+	if (rate->suppressed == 0)
+		return;
 
+	char str[64];
+	sprintf(str, "Log repeated %zu more times", rate->suppressed);
+	write_log_entry(str, "Logs from this position were rate limited",
+			WARNING, 0, rate->fname, rate->func, rate->line,
+			log_timestamp(), NULL, 0);
 
-static struct _LOG_STATUS_T_ _LOG_STATUS_ =
+	rate->suppressed = 0;
+}
+
+
+/* Returns false if the position has already written LOG_RATE_BURST
+ * logs in the current window. A new window starts with the summary
+ * of logs suppressed in previous ones. If consume is false the log
+ * isn't counted, it is used to check the position in advance. */
+static bool log_rate_allows (_CODE_POSITION_T_, bool consume)
 {
-	NULL,
-	false,
-	false,
-	false,
-};
+	bool allows = true;
 
+	pthread_mutex_lock(&_LOG_RATES_.lock);
 
+	log_rate_t *rate = _LOG_RATES_.burst ? find_log_rate(_CODE_POSITION_)
+	                                     : NULL;
+	if (rate && rate->count >= _LOG_RATES_.burst)
+	{
+		uint64_t now = log_monotonic_time();
+		if (now - rate->window_start < _LOG_RATES_.window)
+		{
+			if (consume)
+				rate->suppressed++;
+			allows = false;
+		}
+		else
+		{
+			write_log_rate_summary(rate);
+			rate->window_start = now;
+			rate->count        = 0;
+		}
+	}
 
+	if (rate && allows && consume)
+		rate->count++;
 
-/*==================== Local functions ===================*/
+	pthread_mutex_unlock(&_LOG_RATES_.lock);
 
+	return allows;
+}
 
-static inline void fput_nchars (char ch, int n, FILE* fp)
+
+/* Counts the log which was suppressed without calling log_rate_allows(). */
+static void suppress_log (_CODE_POSITION_T_)
 {
-	for (int i = 0; i < n; ++i)
-		fputc(ch, fp);
-}
+	pthread_mutex_lock(&_LOG_RATES_.lock);
 
+	log_rate_t *rate = find_log_rate(_CODE_POSITION_);
+	if (rate)
+		rate->suppressed++;
 
-#if STACK_TRACE == ON
+	pthread_mutex_unlock(&_LOG_RATES_.lock);
+}
 
-static int print_stack_trace (char **stack_trace, int size, FILE *fp)
+
+static void free_log_rates (void)
 {
-	int printed = fputs("============> STACK TRACE <=============\n", fp);
-	for (int i = 2; i < size; ++i)
+	pthread_mutex_lock(&_LOG_RATES_.lock);
+
+	for (size_t i = 0; i < _LOG_RATES_.capacity; ++i)
 	{
-		printed += fputs(stack_trace[i], fp);
-		fputc('\n', fp);
+		if (_LOG_RATES_.table[i].fname)
+			write_log_rate_summary(&_LOG_RATES_.table[i]);
 	}
-	fputc('\n', fp);
-	return printed;
-}
 
-#endif // STACK_TRACE == ON
+	free(_LOG_RATES_.table);
+	_LOG_RATES_.table    = NULL;
+	_LOG_RATES_.capacity = 0;
+	_LOG_RATES_.count    = 0;
 
+	pthread_mutex_unlock(&_LOG_RATES_.lock);
+}
 
-static bool fprint_log_ (FILE *fp, const char *msg, const char *data,
-		const char *danger_str, int deep_lvl, _CODE_POSITION_T_,
-		char **stack_trace, int stack_trace_size)
+#else
+
+static inline bool log_rate_allows (_CODE_POSITION_T_, bool consume)
 {
-	int printed = -1;
+	(void) fname;
+	(void) func;
+	(void) line;
+	(void) consume;
+	return true;
+}
 
-	fput_nchars('\t', deep_lvl, fp);
-	if (deep_lvl == 0)
-		printed = fprintf(fp, "%s In %s: %s():%d: %s\n",
-				danger_str, fname, func, line, msg);
-	else
-		printed = fprintf(fp, "%s %s\n", danger_str, msg);
 
+static inline void suppress_log (_CODE_POSITION_T_)
+{
+	(void) fname;
+	(void) func;
+	(void) line;
+}
 
-	fput_nchars('\t', deep_lvl, fp);
-	printed += fputs(data, fp);
-	fputc('\n', fp);
-	fputc('\n', fp);
+#endif // LOG_RATE_LIMIT == ON
 
-	#if STACK_TRACE == ON
-		if (deep_lvl == 0)
-		{
-			printed += print_stack_trace(stack_trace,
-					stack_trace_size, fp);
-		}
-	#else
-		(void) stack_trace;
-		(void) stack_trace_size;
-	#endif // STACK_TRACE == ON
 
-	fputc('\n', fp);
+/* The arena isn't freed, so next multilogs reuse its memory. */
+static void reset_sublog (void)
+{
+	_SUBLOG_.used       = 0;
+	_SUBLOG_.count      = 0;
+	_SUBLOG_.danger     = EMPTY;
+	_SUBLOG_.fname      = NULL;
+	_SUBLOG_.func       = NULL;
+	_SUBLOG_.line       = 0;
+	_SUBLOG_.suppressed = false;
+}
 
-	return printed > 0;
+
+static void free_sublog_arena (void *sublog)
+{
+	free(((struct _SUBLOG_T_ *) sublog)->arena);
 }
 
 
-static inline char **get_stack_trace (int *size)
+static void create_sublog_key (void)
 {
-	const size_t BUF_SIZE = 1000;
-	void *buffer[BUF_SIZE];
-	
-	*size = backtrace(buffer, BUF_SIZE);
-	*size -= 2;
-	 return backtrace_symbols(buffer, *size);
+	pthread_key_create(&_SUBLOG_KEY_, free_sublog_arena);
 }
 
 
-static void gen_danger_str (char danger_str[], danger_status_t danger,
-		            bool colorful)
+/* Appends a record to the sublog arena doubling its size if needed. */
+static bool append_sublog (const char *msg, const char *data,
+		danger_status_t danger, int deep_lvl)
 {
-	switch ( danger )
+	log_t record = { danger, deep_lvl, strlen(msg) + 1, strlen(data) + 1 };
+	size_t size = log_record_size(&record);
+
+	if (_SUBLOG_.used + size > _SUBLOG_.arena_size)
 	{
-		case EMPTY:
-			strcpy(danger_str, "");
-			break;
-		case OK:
-			if (colorful)
-				strcpy(danger_str, "\033[1;32m[OK]:\033[0m");
-			else
-				strcpy(danger_str,           "[OK]:");
-			break;
+		size_t new_size = _SUBLOG_.arena_size ? _SUBLOG_.arena_size
+		                                      : SUBLOG_ARENA_SIZE;
+		while (new_size < _SUBLOG_.used + size)
+			new_size *= 2;
 
-		case WARNING:
-			if (colorful)
-				strcpy(danger_str, "\033[1;33m==> WARNING:\033[0m");
-			else
-				strcpy(danger_str,           "==> WARNING:");
-			break;
+		char *new_arena = (char *) realloc(_SUBLOG_.arena, new_size);
+		if (!new_arena)
+			return false;
 
-		case ERROR:
-			if (colorful)
-				strcpy(danger_str, "\033[1;31m!!! ERROR:\033[0m");
-			else	
-				strcpy(danger_str,           "!!! ERROR:");
-			break;
-		default:
-			strcpy(danger_str, "--> UNKNOWN:");
+		/* Arena of the thread is freed when it exits. */
+		if (!_SUBLOG_.arena)
+		{
+			pthread_once(&_SUBLOG_KEY_ONCE_, create_sublog_key);
+			pthread_setspecific(_SUBLOG_KEY_, &_SUBLOG_);
+		}
+
+		_SUBLOG_.arena      = new_arena;
+		_SUBLOG_.arena_size = new_size;
 	}
-}
 
+	log_t *place = (log_t *) (_SUBLOG_.arena + _SUBLOG_.used);
+	*place = record;
+	memcpy((char *) log_record_msg(place),  msg,  record.msg_length);
+	memcpy((char *) log_record_data(place), data, record.data_length);
 
-static void reset_sublog (void)
-{
-	_SUBLOG_.logs  = NULL;
-	_SUBLOG_.count = 0;
-	_SUBLOG_.fname = NULL;
-	_SUBLOG_.func  = NULL;
-	_SUBLOG_.line  = 0;
+	_SUBLOG_.used += size;
+	_SUBLOG_.count++;
+
+	if (danger > _SUBLOG_.danger)
+		_SUBLOG_.danger = danger;
+
+	return true;
 }
 
 
@@ -217,7 +1448,9 @@ bool set_logfile (const char *fname)
 	if (!fp)
 		return false;
 
+	pthread_mutex_lock(&_LOG_STATUS_.lock);
 	_LOG_STATUS_.file = fp;
+	pthread_mutex_unlock(&_LOG_STATUS_.lock);
 
 	return true;
 }
@@ -225,35 +1458,157 @@ bool set_logfile (const char *fname)
 
 void remove_logfile (void)
 {
+	pthread_mutex_lock(&_LOG_STATUS_.lock);
 	if (_LOG_STATUS_.file)
 	{
 		fclose(_LOG_STATUS_.file);
 		_LOG_STATUS_.file = NULL;
 	}
+	pthread_mutex_unlock(&_LOG_STATUS_.lock);
+}
+
+
+bool set_binary_logfile (const char *fname)
+{
+	if (!fname)
+		return false;
+
+	FILE *fp = fopen(fname, "ab");
+	if (!fp)
+		return false;
+
+	/* Header is written only to a new file, appended
+	 * logs define their code positions again. */
+	fseek(fp, 0, SEEK_END);
+	if (ftell(fp) == 0)
+	{
+		binlog_file_header_t header =
+		{
+			.version    = BINLOG_VERSION,
+			.byte_order = BINLOG_BYTE_ORDER,
+		};
+		memcpy(header.magic, BINLOG_MAGIC, sizeof header.magic);
+		if (fwrite(&header, sizeof header, 1, fp) != 1)
+		{
+			fclose(fp);
+			return false;
+		}
+	}
+
+	pthread_mutex_lock(&_LOG_STATUS_.lock);
+	close_binary_logfile();
+	_LOG_STATUS_.binary_file = fp;
+	pthread_mutex_unlock(&_LOG_STATUS_.lock);
+
+	return true;
+}
+
+
+void remove_binary_logfile (void)
+{
+	pthread_mutex_lock(&_LOG_STATUS_.lock);
+	close_binary_logfile();
+	pthread_mutex_unlock(&_LOG_STATUS_.lock);
 }
 
 
 void set_stdout_logging (bool val)
 {
+	pthread_mutex_lock(&_LOG_STATUS_.lock);
 	_LOG_STATUS_.log_stdout = val;
+	pthread_mutex_unlock(&_LOG_STATUS_.lock);
 }
 
 
 void set_stderr_logging (bool val)
 {
+	pthread_mutex_lock(&_LOG_STATUS_.lock);
 	_LOG_STATUS_.log_stderr = val;
+	pthread_mutex_unlock(&_LOG_STATUS_.lock);
+}
+
+
+#if ASYNC_LOGGING == ON
+
+void set_log_overflow (log_overflow_t policy)
+{
+	atomic_store_explicit(&_LOG_QUEUE_.overflow, policy,
+			memory_order_relaxed);
+}
+
+
+size_t dropped_logs_count (void)
+{
+	return atomic_load_explicit(&_LOG_QUEUE_.dropped,
+			memory_order_relaxed);
+}
+
+#endif // ASYNC_LOGGING == ON
+
+
+#if LOG_RATE_LIMIT == ON
+
+void set_log_rate_limit (unsigned window, size_t burst)
+{
+	pthread_mutex_lock(&_LOG_RATES_.lock);
+	_LOG_RATES_.window = (uint64_t) window * 1000000;
+	_LOG_RATES_.burst  = burst;
+	pthread_mutex_unlock(&_LOG_RATES_.lock);
+}
+
+#endif // LOG_RATE_LIMIT == ON
+
+
+void set_log_level (danger_status_t level)
+{
+	_LOG_LEVEL_ = level;
 }
 
 
 void start_logging_func_ (void)
 {
-	_LOG_STATUS_.log_started = true;
+	#if ASYNC_LOGGING == ON
+		static bool exit_handler_set = false;
+
+		/* If the writer can't be started logs are written synchronously. */
+		if (!atomic_load(&_LOG_QUEUE_.running) && start_log_writer() &&
+				!exit_handler_set)
+		{
+			/* Queued records are written even if
+			 * stop_logging() wasn't called. */
+			exit_handler_set = atexit(stop_log_writer) == 0;
+		}
+	#endif // ASYNC_LOGGING == ON
+
+	atomic_store(&_LOG_STATUS_.log_started, true);
 }
 
 
 void stop_logging_func_ (void)
 {
-	_LOG_STATUS_.log_started = false;
+	#if LOG_RATE_LIMIT == ON
+		if (log_is_started())
+			free_log_rates();
+	#endif // LOG_RATE_LIMIT == ON
+
+	#if ASYNC_LOGGING == ON
+		stop_log_writer();
+	#endif // ASYNC_LOGGING == ON
+
+	atomic_store(&_LOG_STATUS_.log_started, false);
+
+	#if STACK_TRACE == ON
+		pthread_mutex_lock(&_LOG_STATUS_.lock);
+		free_log_symbols();
+		pthread_mutex_unlock(&_LOG_STATUS_.lock);
+	#endif // STACK_TRACE == ON
+
+	if (_SUBLOG_.count == 0)
+	{
+		free(_SUBLOG_.arena);
+		_SUBLOG_.arena      = NULL;
+		_SUBLOG_.arena_size = 0;
+	}
 }
 
 
@@ -261,38 +1616,38 @@ void multilog_begin_at (const char *msg, const char *data,
 		_CODE_POSITION_T_)
 {
 	if (_SUBLOG_.count != 0 &&
-			! is_bad_mem(_SUBLOG_.logs, _SUBLOG_.count))
+			! is_bad_mem(_SUBLOG_.arena, _SUBLOG_.used))
 	{
 		write_log("Multilog wasn't ended.", "", WARNING, 0);
 		multilog_end(EMPTY);
 	}
 	else if (_SUBLOG_.count != 0)
 	{
-		char str[50];
-		sprintf(str, "_SUBLOG_.count = %zd, _SUBLOG_.logs = %p",
-				_SUBLOG_.count, _SUBLOG_.logs);
+		char str[100];
+		sprintf(str, "_SUBLOG_.count = %zd, _SUBLOG_.arena = %p",
+				_SUBLOG_.count, _SUBLOG_.arena);
 		write_log("Sublog corrupted!", str, ERROR, 0);
+		_SUBLOG_.arena      = NULL;
+		_SUBLOG_.arena_size = 0;
 	}
 
+	reset_sublog();
+
 	_SUBLOG_.fname = fname;
 	_SUBLOG_.func = func;
 	_SUBLOG_.line = line;
 
-	_SUBLOG_.logs = (log_t *) calloc(1, sizeof *_SUBLOG_.logs);
-	if (!_SUBLOG_.logs)
+	/* Sublogs of a rate limited multilog aren't collected. */
+	_SUBLOG_.suppressed = log_is_started() &&
+	                      !log_rate_allows(_CODE_POSITION_, false);
+
+	if (!append_sublog(msg, data, EMPTY, 0))
 	{
 		write_log("Sublog cannot be created!", "Allocation error",
 				ERROR, 0);
 		write_log(msg, data, EMPTY, 1);
 		abort();
 	}
-
-	strcpy(_SUBLOG_.logs[0].msg, msg);
-	strcpy(_SUBLOG_.logs[0].data, data);
-	_SUBLOG_.logs[0].danger = EMPTY;
-	_SUBLOG_.logs[0].deep_lvl = 0;
-
-	_SUBLOG_.count = 1;
 }
 
 
@@ -306,58 +1661,65 @@ void multilog_end (danger_status_t min_printed_danger)
 		reset_sublog();
 		return;
 	}
-	else if (is_bad_mem(_SUBLOG_.logs,
-				_SUBLOG_.count * sizeof *_SUBLOG_.logs))
+	else if (_SUBLOG_.used > _SUBLOG_.arena_size ||
+			is_bad_mem(_SUBLOG_.arena, _SUBLOG_.used))
 	{
 		write_log("Sublog was corrupted!", "", ERROR, 0);
+		_SUBLOG_.arena      = NULL;
+		_SUBLOG_.arena_size = 0;
 		reset_sublog();
 		return;
 	}
 	
-	if (_SUBLOG_.logs[0].danger >= min_printed_danger)
+	if (_SUBLOG_.suppressed)
+		suppress_log(_SUBLOG_.fname, _SUBLOG_.func, _SUBLOG_.line);
+	else if (log_is_started() &&
+			_SUBLOG_.danger >= min_printed_danger &&
+			log_rate_allows(_SUBLOG_.fname, _SUBLOG_.func,
+					_SUBLOG_.line, true))
 	{
-		for (size_t log = 0; log < _SUBLOG_.count; ++log)
-			write_log_at(_SUBLOG_.logs[log].msg, _SUBLOG_.logs[log].data,
-			  _SUBLOG_.logs[log].danger, _SUBLOG_.logs[log].deep_lvl,
-			  _SUBLOG_.fname, _SUBLOG_.func, _SUBLOG_.line);
+		uint64_t timestamp = log_timestamp();
+
+		void *stack_trace[MAX_STACK_TRACE_DEPTH];
+		int stack_trace_size = 0;
+
+		#if STACK_TRACE == ON
+			stack_trace_size = get_stack_trace(stack_trace);
+		#endif // STACK_TRACE == ON
+
+		write_multilog_entry(_SUBLOG_.danger, _SUBLOG_.fname,
+				_SUBLOG_.func, _SUBLOG_.line, timestamp,
+				stack_trace, stack_trace_size);
 	}
 
-	free(_SUBLOG_.logs);
 	reset_sublog();
 }
 
 
-void add_sublog (const char *msg, const char *data,
+void add_sublog_func_ (const char *msg, const char *data,
 		danger_status_t danger, int deep_lvl)
 {
-	void *realloc_check = realloc(_SUBLOG_.logs,
-			(_SUBLOG_.count + 1) * sizeof *_SUBLOG_.logs);
-	if (!realloc_check)
+	if (_SUBLOG_.suppressed)
+		return;
+
+	if (!append_sublog(msg, data, danger, deep_lvl))
 	{
 		write_log("Failed adding new sublog!",
 				"----------------------------------------------",
 				ERROR, deep_lvl);
 		write_log(msg, data, danger, deep_lvl);
 	}
-	_SUBLOG_.logs = (log_t *) realloc_check;
-
-	strcpy(_SUBLOG_.logs[_SUBLOG_.count].msg, msg);
-	strcpy(_SUBLOG_.logs[_SUBLOG_.count].data, data);
-	_SUBLOG_.logs[_SUBLOG_.count].danger = danger;
-	_SUBLOG_.logs[_SUBLOG_.count].deep_lvl = deep_lvl;
-	
-	_SUBLOG_.count++;
-
-	if ( danger > _SUBLOG_.logs[0].danger )
-		_SUBLOG_.logs[0].danger = danger;
 }
 
 
-void add_table_log (const char *msg, const void *arr,
+void add_table_log_func_ (const char *msg, const void *arr,
 		size_t size, size_t element_size,
 		void (*print_func)(char *, const void *),
 		danger_status_t danger, int deep_lvl)
 {
+	if (_SUBLOG_.suppressed)
+		return;
+
 	if (size < 1)
 	{
 		add_sublog("Size of logging array must be positive.", "",
@@ -404,56 +1766,22 @@ void write_log_at (const char *msg, const char *data,
 		danger_status_t danger, int deep_lvl,
 		_CODE_POSITION_T_)
 {
-	if (!_LOG_STATUS_.log_started)
+	if (!log_is_started() ||
+			!log_rate_allows(_CODE_POSITION_, true))
 		return;
 
-	bool logging_success = true;
+	uint64_t timestamp = log_timestamp();
 
-	char **stack_trace = NULL;
+	void *stack_trace[MAX_STACK_TRACE_DEPTH];
 	int stack_trace_size = 0;
 	
 	#if STACK_TRACE == ON
 		if (deep_lvl == 0)
-			stack_trace = get_stack_trace(&stack_trace_size);
-	#endif // STACK_TRACE == ON
-
-	char danger_str[25];
-
-	if (_LOG_STATUS_.file)
-	{
-		gen_danger_str(danger_str, danger, false);
-		logging_success &= fprint_log_(_LOG_STATUS_.file, msg, data,
-				danger_str, deep_lvl, fname, func, line,
-				stack_trace, stack_trace_size);
-		fflush(_LOG_STATUS_.file);
-	}
-
-	if (_LOG_STATUS_.log_stdout)
-	{
-		gen_danger_str(danger_str, danger, true);
-		logging_success &= fprint_log_(stdout, msg, data,
-				danger_str, deep_lvl, fname, func, line,
-				stack_trace, stack_trace_size);
-	}
-
-	if (_LOG_STATUS_.log_stderr)
-	{
-		gen_danger_str(danger_str, danger, true);
-		logging_success &= fprint_log_(stderr, msg, data,
-				danger_str, deep_lvl, fname, func, line,
-				stack_trace, stack_trace_size);
-	}
-
-	#if STACK_TRACE == ON
-		free(stack_trace);
+			stack_trace_size = get_stack_trace(stack_trace);
 	#endif // STACK_TRACE == ON
 
-	if (!logging_success)
-	{
-		perror("Logging failed!!!\n"
-				"The program was interrupted.");
-		abort();
-	}
+	write_log_entry(msg, data, danger, deep_lvl, _CODE_POSITION_,
+			timestamp, stack_trace, stack_trace_size);
 }
 
 
@@ -46,6 +46,18 @@ typedef enum danger_status_t_
 } danger_status_t;
 
 
+/*! This type defines what the async logging does
+ *  when its queue is full.
+ */
+typedef enum log_overflow_t_
+{
+	LOG_OVERFLOW_BLOCK = 0, /*!< Caller waits for a free place in the queue. */
+	LOG_OVERFLOW_DROP  = 1, /*!< Record is silently dropped. */
+	LOG_OVERFLOW_COUNT = 2, /*!< Record is dropped, the number of dropped
+	                             records is written by the writer thread. */
+} log_overflow_t;
+
+
 
 
 /*!
@@ -86,6 +98,22 @@ bool set_logfile (const char* fname);
 void remove_logfile (void);
 
 
+/*!
+ * This function sets the file for logging in binary format.
+ * It is written along with text logs and can be
+ * converted to text by tools/log_decoder.
+ *
+ *  @param[in] fname - name of the file where logs will be written.
+ */
+bool set_binary_logfile (const char* fname);
+
+
+/*!
+ * This function stops logging to binary file.
+ */
+void remove_binary_logfile (void);
+
+
 /*!
  * This function sets status of logging to stdout
  * 
@@ -104,9 +132,59 @@ void set_stdout_logging (bool val);
 void set_stderr_logging (bool val);
 
 
+#if LOG_RATE_LIMIT == ON
+
+/*!
+ * This function sets how many logs can be written from one code
+ * position. The rest are counted and reported by a summary log.
+ *
+ * @param[in] window - length of the window in milliseconds.
+ * @param[in] burst  - max number of logs per window, 0 - no limit.
+ */
+void set_log_rate_limit (unsigned window, size_t burst);
+
+#else
+
+
+#define set_log_rate_limit(window, burst) (void) 0
+
+
+#endif // LOG_RATE_LIMIT == ON
+
+
+#if ASYNC_LOGGING == ON
+
+/*!
+ * This function sets the policy of the async logging queue overflow.
+ *
+ * @param[in] policy - what to do with a record if the queue is full.
+ */
+void set_log_overflow (log_overflow_t policy);
+
+
+/*!
+ * This function returns the number of records which were
+ * dropped because the async logging queue was full.
+ */
+size_t dropped_logs_count (void);
+
+#else
+
+
+#define set_log_overflow(policy) (void) 0
+
+
+#define dropped_logs_count() ((size_t) 0)
+
+
+#endif // ASYNC_LOGGING == ON
+
+
 /*!
  * This function starts logging process.
  *
+ * @note With ASYNC_LOGGING it starts the writer thread.
+ *
  * @note Use macro start_logging() instead of this function.
  */
 void start_logging_func_ (void);
@@ -115,6 +193,9 @@ void start_logging_func_ (void);
 /*!
  * This function stops logging process.
  *
+ * @note With ASYNC_LOGGING it waits until all queued
+ *       records are written and stops the writer thread.
+ *
  * @note Use macro stop_logging() instead of this function.
  */
 void stop_logging_func_ (void);
@@ -150,8 +231,10 @@ void multilog_end (danger_status_t min_printed_danger);
  *  @param[in] data      - data that should be printed in this log.
  *  @param[in] danger    - warning status of this log.
  *  @param[int] deep_lvl - nesting level of this log.
+ *
+ *  @note Use macro add_sublog() instead of this function.
  */
-void add_sublog (const char *msg, const char *data,
+void add_sublog_func_ (const char *msg, const char *data,
 		danger_status_t danger, int deep_lvl);
 
 
@@ -165,8 +248,10 @@ void add_sublog (const char *msg, const char *data,
  *  \param[in] print_func   - function which converts the data to a string.
  *  @param[in] danger       - warning status of this log.
  *  @param[in] deep_lvl     - nesting level of this log.
+ *
+ *  @note Use macro add_table_log() instead of this function.
  */
-void add_table_log (const char *msg, const void *arr,
+void add_table_log_func_ (const char *msg, const void *arr,
 		size_t size, size_t element_size,
 		void (*print_func)(char *, const void *),
 		danger_status_t danger, int deep_lvl);
@@ -182,17 +267,47 @@ void add_table_log (const char *msg, const void *arr,
  *  that will be printed in the header of the multi-log.
  *
  *  @note If logging failed function crashes the program.
+ *  @note With ASYNC_LOGGING the record is only put into the queue,
+ *        fname and func must point to static strings.
  */
 void write_log_at (const char *msg, const char *data,
 		danger_status_t danger, int deep_lvl,
 		_CODE_POSITION_T_);
 
 
+/*! This function sets min warning status of logs which are written
+ *  by macros write_log(), if_log(), add_sublog() and add_table_log().
+ *  Logs with EMPTY status are always written.
+ *
+ *  @param[in] level - min warning status.
+ *
+ *  @note Logs below MIN_LOG_LEVEL are removed at compile time
+ *        and can't be enabled by this function.
+ */
+void set_log_level (danger_status_t level);
+
+
+/*!
+ * Min warning status set by set_log_level().
+ * Used by macros, don't change it directly.
+ */
+extern _Atomic danger_status_t _LOG_LEVEL_;
+
 
 
 /*================== Functional macros ===================*/
 
 
+/*! This macro checks if logs with the warning status are written.
+ *  If DANGER_ is a constant below MIN_LOG_LEVEL
+ *  the condition is false at compile time.
+ *
+ *  @param[in] DANGER_ - warning status of log, it may be evaluated twice.
+ */
+#define log_level_enabled(DANGER_) ((DANGER_) == EMPTY ||\
+	((DANGER_) >= MIN_LOG_LEVEL && (DANGER_) >= _LOG_LEVEL_))
+
+
 /*! This macro starts logging process.
  *
  */
@@ -234,9 +349,9 @@ void write_log_at (const char *msg, const char *data,
  *  @param[in] DANGER_STATUS - warning status of log that may be written.
  */
 #define if_log(ASSERTION_, DANGER_STATUS_) if (\
-	(ASSERTION_) && (\
+	(ASSERTION_) && (!log_level_enabled(DANGER_STATUS_) || (\
 	write_log_at("Assertion failed:", #ASSERTION_, DANGER_STATUS_,\
-			0, _CURRENT_CODE_POSITION_), true) )
+			0, _CURRENT_CODE_POSITION_), true)) )
 
 
 /*! This macro writes log to the previously assigned places
@@ -249,8 +364,37 @@ void write_log_at (const char *msg, const char *data,
  */
 #define write_log(MESSAGE_, DATA_, DANGER_STATUS_, DEEP_LVL_) \
 {\
-	write_log_at(MESSAGE_, DATA_,\
-			DANGER_STATUS_, DEEP_LVL_, _CURRENT_CODE_POSITION_);\
+	if (log_level_enabled(DANGER_STATUS_))\
+		write_log_at(MESSAGE_, DATA_,\
+				DANGER_STATUS_, DEEP_LVL_, _CURRENT_CODE_POSITION_);\
+} (void) 0
+
+
+/*! This macro adds log to multi-log if its warning status
+ *  isn't filtered out.
+ *
+ *  @param[in] MESSAGE_       - description of log.
+ *  @param[in] DATA_          - data that should be printed in this log.
+ *  @param[in] DANGER_STATUS_ - warning status of this log.
+ *  @param[in] DEEP_LVL_      - nesting level of this log.
+ */
+#define add_sublog(MESSAGE_, DATA_, DANGER_STATUS_, DEEP_LVL_) \
+{\
+	if (log_level_enabled(DANGER_STATUS_))\
+		add_sublog_func_(MESSAGE_, DATA_, DANGER_STATUS_, DEEP_LVL_);\
+} (void) 0
+
+
+/*! This macro adds data array in the form of a table to the multi-log
+ *  if its warning status isn't filtered out.
+ *  Parameters are the same as add_table_log_func_() has.
+ */
+#define add_table_log(MESSAGE_, ARR_, SIZE_, ELEMENT_SIZE_, PRINT_FUNC_,\
+		DANGER_STATUS_, DEEP_LVL_) \
+{\
+	if (log_level_enabled(DANGER_STATUS_))\
+		add_table_log_func_(MESSAGE_, ARR_, SIZE_, ELEMENT_SIZE_,\
+				PRINT_FUNC_, DANGER_STATUS_, DEEP_LVL_);\
 } (void) 0
 
 
@@ -289,12 +433,24 @@ void write_log_at (const char *msg, const char *data,
 #define write_log(MESSAGE_, DATA_, DANGER_STATUS_, DEEP_LVL_) (void) 0
 
 
+#define log_level_enabled(DANGER_) 0
+
+
+#define set_log_level(level) (void) 0
+
+
 #define set_logfile(fname) 1 /* true */
 
 
 #define remove_logfile() (void) 0
 
 
+#define set_binary_logfile(fname) 1 /* true */
+
+
+#define remove_binary_logfile() (void) 0
+
+
 #define set_stdout_logging(val) (void) 0
 
 
@@ -304,10 +460,19 @@ void write_log_at (const char *msg, const char *data,
 #define start_logging_func_() (void) 0
 
 
+#define set_log_overflow(policy) (void) 0
+
+
+#define dropped_logs_count() ((size_t) 0)
+
+
+#define set_log_rate_limit(window, burst) (void) 0
+
+
 #define stop_logging_func_() (void) 0
 
 
-#define write_log_at(msg, data, danger, deep_lvl, fname, func, line) (void) 0
+#define write_log_at(...) (void) 0
 
 
 #endif
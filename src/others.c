@@ -9,12 +9,436 @@
 /*================= Connecting headers ==================*/
 
 
+#define _GNU_SOURCE
+
+#include "../config/secure_stack.config.h"
 #include "others.h"
 #include "logging.h"
 
 #include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#if POISON_SIMD == ON && (defined(__x86_64__) || defined(__i386__))
+	#define POISON_X86_KERNELS_
+	#include <immintrin.h>
+#endif
+
+
+
+
+/*================== Local constants =====================*/
+
+
+/*!
+ * Max number of separate ranges in the cache of readable memory.
+ */
+#define MEM_CACHE_SIZE 64
+
+/*!
+ * Number of invalidated ranges which are kept for other threads.
+ * A thread which has missed more of them clears its cache.
+ */
+#define MEM_CACHE_LOG_SIZE 64
+
+/*!
+ * Max number of pages which are probed by one system call.
+ */
+#define PROBE_BATCH_SIZE 64
+
+
+
+
+/*!
+ * Memory is verified by blocks of this size, so the kernels
+ * don't check the result after every vector.
+ */
+#define POISON_BLOCK_SIZE 128
+
+
+
+
+/*========================= Types ========================*/
+
+
+typedef struct mem_range_t_
+{
+	uintptr_t begin;
+	uintptr_t end;
+} mem_range_t;
+
+
+/* Every thread has its own cache. Invalidation in one thread
+ * is published to the log, so other threads remove only
+ * the invalidated ranges from their caches. */
+struct _MEM_CACHE_T_
+{
+	mem_range_t ranges[MEM_CACHE_SIZE];
+	size_t      count;
+	size_t      page_size;
+	bool        no_vm_readv;
+	size_t      synced; /* number of log records which are applied. */
+};
+
+
+/* Ring of the last invalidated ranges. count is the number
+ * of all records, it is read without the lock. */
+struct _MEM_CACHE_LOG_T_
+{
+	pthread_mutex_t lock;
+	mem_range_t     ranges[MEM_CACHE_LOG_SIZE];
+	atomic_size_t   count;
+};
+
+
+
+
+/* Checks size bytes, size is a multiple of POISON_BLOCK_SIZE. */
+typedef bool (*poison_kernel_t) (const unsigned char *ptr, uint64_t pattern,
+		size_t size);
+
+
+
+
+/*=================== Local variables ====================*/
+
+
+static _Thread_local struct _MEM_CACHE_T_ _MEM_CACHE_ =
+{
+	{ { 0, 0 } },
+	0,
+	0,
+	false,
+	0,
+};
+
+
+static struct _MEM_CACHE_LOG_T_ _MEM_CACHE_LOG_ =
+{
+	PTHREAD_MUTEX_INITIALIZER,
+	{ { 0, 0 } },
+	0,
+};
+
+
+
+
+/*==================== Local functions ===================*/
+
+
+static inline uintptr_t page_floor (uintptr_t addr)
+{
+	return addr & ~(uintptr_t) (_MEM_CACHE_.page_size - 1);
+}
+
+
+static inline uintptr_t page_ceil (uintptr_t addr)
+{
+	return page_floor(addr + _MEM_CACHE_.page_size - 1);
+}
+
+
+/* Returns index of the first range which ends after addr. */
+static size_t mem_cache_lower_bound (uintptr_t addr)
+{
+	size_t left = 0, right = _MEM_CACHE_.count;
+	while (left < right)
+	{
+		size_t mid = left + (right - left) / 2;
+		if (_MEM_CACHE_.ranges[mid].end <= addr)
+			left = mid + 1;
+		else
+			right = mid;
+	}
+	return left;
+}
+
+
+static void mem_cache_insert (uintptr_t begin, uintptr_t end)
+{
+	size_t first = mem_cache_lower_bound(begin);
+	if (first > 0 && _MEM_CACHE_.ranges[first - 1].end == begin)
+		first--;
+
+	size_t last = first;
+	while (last < _MEM_CACHE_.count && _MEM_CACHE_.ranges[last].begin <= end)
+	{
+		if (_MEM_CACHE_.ranges[last].begin < begin)
+			begin = _MEM_CACHE_.ranges[last].begin;
+		if (_MEM_CACHE_.ranges[last].end > end)
+			end = _MEM_CACHE_.ranges[last].end;
+		last++;
+	}
+
+	if (first == last && _MEM_CACHE_.count == MEM_CACHE_SIZE)
+	{
+		_MEM_CACHE_.count = 0;
+		first = last = 0;
+	}
+
+	memmove(_MEM_CACHE_.ranges + first + 1, _MEM_CACHE_.ranges + last,
+		(_MEM_CACHE_.count - last) * sizeof *_MEM_CACHE_.ranges);
+	_MEM_CACHE_.count -= last - first;
+	_MEM_CACHE_.count++;
+
+	_MEM_CACHE_.ranges[first].begin = begin;
+	_MEM_CACHE_.ranges[first].end   = end;
+}
+
+
+/* Removes pages which contain [begin, end) from the cache. */
+static void mem_cache_remove (uintptr_t begin, uintptr_t end)
+{
+	if (_MEM_CACHE_.count == 0)
+		return;
+
+	begin = page_floor(begin);
+	end   = end > UINTPTR_MAX - _MEM_CACHE_.page_size ? UINTPTR_MAX
+	                                                 : page_ceil(end);
+
+	size_t index = mem_cache_lower_bound(begin);
+	while (index < _MEM_CACHE_.count &&
+			_MEM_CACHE_.ranges[index].begin < end)
+	{
+		mem_range_t *range = _MEM_CACHE_.ranges + index;
+
+		if (range->begin < begin && range->end > end)
+		{
+			if (_MEM_CACHE_.count == MEM_CACHE_SIZE)
+			{
+				_MEM_CACHE_.count = 0;
+				return;
+			}
+			memmove(range + 1, range, (_MEM_CACHE_.count - index)
+					* sizeof *range);
+			_MEM_CACHE_.count++;
+			range[0].end   = begin;
+			range[1].begin = end;
+			return;
+		}
+		else if (range->begin < begin)
+		{
+			range->end = begin;
+			index++;
+		}
+		else if (range->end > end)
+		{
+			range->begin = end;
+			return;
+		}
+		else
+		{
+			memmove(range, range + 1, (_MEM_CACHE_.count - index - 1)
+					* sizeof *range);
+			_MEM_CACHE_.count--;
+		}
+	}
+}
+
+
+/* Tells other threads that [begin, end) isn't readable any more. */
+static void mem_cache_publish (uintptr_t begin, uintptr_t end)
+{
+	pthread_mutex_lock(&_MEM_CACHE_LOG_.lock);
+
+	size_t count = atomic_load_explicit(&_MEM_CACHE_LOG_.count,
+			memory_order_relaxed);
+	mem_range_t *record = _MEM_CACHE_LOG_.ranges + count % MEM_CACHE_LOG_SIZE;
+	record->begin = begin;
+	record->end   = end;
+	atomic_store_explicit(&_MEM_CACHE_LOG_.count, count + 1,
+			memory_order_release);
+
+	pthread_mutex_unlock(&_MEM_CACHE_LOG_.lock);
+}
+
+
+/* Removes ranges invalidated by other threads from the cache.
+ * The cache is cleared only if some records are already overwritten. */
+static void mem_cache_sync (void)
+{
+	size_t count = atomic_load_explicit(&_MEM_CACHE_LOG_.count,
+			memory_order_acquire);
+	if (count == _MEM_CACHE_.synced)
+		return;
+
+	mem_range_t ranges[MEM_CACHE_LOG_SIZE];
+	size_t missed = 0;
+
+	if (_MEM_CACHE_.count > 0)
+	{
+		pthread_mutex_lock(&_MEM_CACHE_LOG_.lock);
+
+		count = atomic_load_explicit(&_MEM_CACHE_LOG_.count,
+				memory_order_relaxed);
+		missed = count - _MEM_CACHE_.synced;
+		if (missed <= MEM_CACHE_LOG_SIZE)
+			for (size_t i = 0; i < missed; ++i)
+				ranges[i] = _MEM_CACHE_LOG_.ranges[(_MEM_CACHE_.synced + i)
+						% MEM_CACHE_LOG_SIZE];
+
+		pthread_mutex_unlock(&_MEM_CACHE_LOG_.lock);
+	}
+
+	if (missed > MEM_CACHE_LOG_SIZE)
+		_MEM_CACHE_.count = 0;
+	else
+		for (size_t i = 0; i < missed; ++i)
+			mem_cache_remove(ranges[i].begin, ranges[i].end);
+
+	_MEM_CACHE_.synced = count;
+}
+
+
+static size_t probe_pages_access (uintptr_t first_page, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+		if (is_bad_byte_ptr((const void *)
+				(first_page + i * _MEM_CACHE_.page_size)))
+			return i;
+	return count;
+}
+
+
+/* Returns the number of consecutive readable pages from first_page. */
+static size_t probe_pages (uintptr_t first_page, size_t count)
+{
+	if (_MEM_CACHE_.no_vm_readv)
+		return probe_pages_access(first_page, count);
+
+	char         buffer[PROBE_BATCH_SIZE];
+	struct iovec remote[PROBE_BATCH_SIZE];
+	size_t       good = 0;
+
+	while (good < count)
+	{
+		size_t batch = count - good;
+		if (batch > PROBE_BATCH_SIZE)
+			batch = PROBE_BATCH_SIZE;
+
+		for (size_t i = 0; i < batch; ++i)
+		{
+			remote[i].iov_base = (void *) (first_page +
+					(good + i) * _MEM_CACHE_.page_size);
+			remote[i].iov_len  = 1;
+		}
+		struct iovec local = { buffer, batch };
+
+		ssize_t read = process_vm_readv(getpid(), &local, 1,
+				remote, batch, 0);
+		if (read < 0 && errno != EFAULT)
+		{
+			_MEM_CACHE_.no_vm_readv = true;
+			return good + probe_pages_access(first_page +
+					good * _MEM_CACHE_.page_size,
+					count - good);
+		}
+		if (read < 0)
+			return good;
+
+		good += (size_t) read;
+		if ((size_t) read < batch)
+			return good;
+	}
+
+	return good;
+}
+
+
+
+
+static inline uint64_t load64 (const unsigned char *ptr)
+{
+	uint64_t value;
+	memcpy(&value, ptr, sizeof value);
+	return value;
+}
+
+
+static bool poison_verify_scalar (const unsigned char *ptr, uint64_t pattern,
+		size_t size)
+{
+	for (size_t i = 0; i < size; i += POISON_BLOCK_SIZE)
+	{
+		uint64_t diff = 0;
+		for (size_t j = 0; j < POISON_BLOCK_SIZE; j += sizeof diff)
+			diff |= load64(ptr + i + j) ^ pattern;
+
+		if (diff)
+			return false;
+	}
+	return true;
+}
+
+
+#ifdef POISON_X86_KERNELS_
+
+__attribute__((target("sse2")))
+static bool poison_verify_sse2 (const unsigned char *ptr, uint64_t pattern,
+		size_t size)
+{
+	const __m128i poison = _mm_set1_epi64x((long long) pattern);
+
+	for (size_t i = 0; i < size; i += POISON_BLOCK_SIZE)
+	{
+		const __m128i *block = (const __m128i *) (ptr + i);
+		__m128i diff = _mm_setzero_si128();
+
+		for (size_t j = 0; j < POISON_BLOCK_SIZE / sizeof (__m128i); ++j)
+			diff = _mm_or_si128(diff, _mm_xor_si128(
+					_mm_loadu_si128(block + j), poison));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff,
+				_mm_setzero_si128())) != 0xFFFF)
+			return false;
+	}
+	return true;
+}
+
+
+__attribute__((target("avx2")))
+static bool poison_verify_avx2 (const unsigned char *ptr, uint64_t pattern,
+		size_t size)
+{
+	const __m256i poison = _mm256_set1_epi64x((long long) pattern);
+
+	for (size_t i = 0; i < size; i += POISON_BLOCK_SIZE)
+	{
+		const __m256i *block = (const __m256i *) (ptr + i);
+		__m256i diff = _mm256_setzero_si256();
+
+		for (size_t j = 0; j < POISON_BLOCK_SIZE / sizeof (__m256i); ++j)
+			diff = _mm256_or_si256(diff, _mm256_xor_si256(
+					_mm256_loadu_si256(block + j), poison));
+
+		if (!_mm256_testz_si256(diff, diff))
+			return false;
+	}
+	return true;
+}
+
+#endif // POISON_X86_KERNELS_
+
+
+static poison_kernel_t select_poison_kernel (void)
+{
+	#ifdef POISON_X86_KERNELS_
+
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return poison_verify_avx2;
+		if (__builtin_cpu_supports("sse2"))
+			return poison_verify_sse2;
+
+	#endif // POISON_X86_KERNELS_
+
+	return poison_verify_scalar;
+}
 
 
 
@@ -37,12 +461,98 @@ bool is_bad_mem (const void* ptr, size_t size)
 	if_log (size == 0, WARNING)
 		return true;
 
-	for (size_t i = 0; i < size; ++i)
+	uintptr_t addr = (uintptr_t) ptr, end = addr + size;
+	if (end < addr)
+		return true;
+
+	if (!_MEM_CACHE_.page_size)
+		_MEM_CACHE_.page_size = (size_t) sysconf(_SC_PAGESIZE);
+
+	mem_cache_sync();
+
+	while (addr < end)
 	{
-		bool result = is_bad_byte_ptr(ptr + i);
-		if (result)
-				return true;
+		size_t index = mem_cache_lower_bound(addr);
+		if (index < _MEM_CACHE_.count &&
+				_MEM_CACHE_.ranges[index].begin <= addr)
+		{
+			addr = _MEM_CACHE_.ranges[index].end;
+			continue;
+		}
+
+		uintptr_t first_page = page_floor(addr),
+		          last_page  = page_ceil(end);
+		if (index < _MEM_CACHE_.count &&
+				_MEM_CACHE_.ranges[index].begin < last_page)
+			last_page = _MEM_CACHE_.ranges[index].begin;
+
+		size_t count = (last_page - first_page) / _MEM_CACHE_.page_size;
+		size_t good  = probe_pages(first_page, count);
+
+		if (good > 0)
+			mem_cache_insert(first_page,
+					first_page + good * _MEM_CACHE_.page_size);
+		if (good < count)
+			return true;
+
+		addr = last_page;
 	}
 
 	return false;
 }
+
+
+void mem_cache_invalidate (const void *ptr, size_t size)
+{
+	if (size == 0)
+		return;
+
+	uintptr_t begin = (uintptr_t) ptr;
+	mem_cache_publish(begin, begin + size);
+	mem_cache_remove(begin, begin + size);
+}
+
+
+void mem_cache_reset (void)
+{
+	_MEM_CACHE_.count = 0;
+	mem_cache_publish(0, UINTPTR_MAX);
+}
+
+
+/* memset of libc is vectorized already, so it is the fill kernel. */
+void poison_fill (void *ptr, unsigned char poison, size_t size)
+{
+	memset(ptr, poison, size);
+}
+
+
+bool poison_verify (const void *ptr, unsigned char poison, size_t size)
+{
+	static poison_kernel_t kernel = NULL;
+
+	const unsigned char *bytes = (const unsigned char *) ptr;
+	uint64_t pattern = poison * 0x0101010101010101ULL;
+
+	/* The tail which doesn't fill a block is checked by bytes. */
+	size_t blocks_size = size - size % POISON_BLOCK_SIZE;
+	for (size_t i = blocks_size; i < size; ++i)
+	{
+		if (bytes[i] != poison)
+			return false;
+	}
+
+	if (blocks_size == 0)
+		return true;
+
+	/* Threads may select the kernel at the same time,
+	 * all of them store the same pointer. */
+	poison_kernel_t selected = __atomic_load_n(&kernel, __ATOMIC_RELAXED);
+	if (!selected)
+	{
+		selected = select_poison_kernel();
+		__atomic_store_n(&kernel, selected, __ATOMIC_RELAXED);
+	}
+
+	return selected(bytes, pattern, blocks_size);
+}
@@ -43,11 +43,53 @@ bool is_bad_byte_ptr (const void* ptr);
  *
  *  @return True if memory is not readable else false.
  *
- *  @note This function uses Linux system calls.
+ *  @note This function uses Linux system calls. Memory is probed
+ *        once per page and readable pages are cached, so if you unmap
+ *        or free memory which was checked earlier, call
+ *        mem_cache_invalidate() for it.
  */
 bool is_bad_mem (const void* ptr, size_t size);
 
 
+/*! This function removes memory from the caches of readable pages
+ *  used by is_bad_mem(). Other threads remove it from their caches
+ *  on their next call of is_bad_mem().
+ *
+ *  @param[in] ptr  - pointer to the begining of the memory.
+ *  @param[in] size - size of the memory.
+ */
+void mem_cache_invalidate (const void *ptr, size_t size);
+
+
+/*! This function clears the caches of readable pages
+ *  used by is_bad_mem() in all threads.
+ */
+void mem_cache_reset (void);
+
+
+/*! This function fills memory with poison byte.
+ *
+ *  @param[out] ptr   - pointer to the begining of the memory.
+ *  @param[in] poison - value of every byte.
+ *  @param[in] size   - size of the memory.
+ */
+void poison_fill (void *ptr, unsigned char poison, size_t size);
+
+
+/*! This function checks that every byte of memory is poison.
+ *
+ *  @param[in] ptr    - pointer to the begining of the memory.
+ *  @param[in] poison - expected value of every byte.
+ *  @param[in] size   - size of the memory.
+ *
+ *  @return true if all bytes are equal to poison else false.
+ *
+ *  @note SSE2 or AVX2 implementation is chosen on the first call
+ *        depending on the processor if POISON_SIMD is ON.
+ */
+bool poison_verify (const void *ptr, unsigned char poison, size_t size);
+
+
 /*! This macro checks if the value pointed to by the pointer can be read.
  *
  *  @param PTR_ - pointer that will be checked.
@@ -9,6 +9,8 @@
 /*================= Connectiong headers ==================*/
 
 
+#define _GNU_SOURCE
+
 #include "secure_stack.h"
 #include "others.h"
 
@@ -18,8 +20,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 
 
@@ -27,85 +32,170 @@
 /*================== Local functions =====================*/
 
 
-static size_t reduce_capacity (size_t capacity, size_t new_size)
+/*! Capacity which is allocated by the first push
+ *  if the stack grows geometrically.
+ */
+#define MIN_CAPACITY 4
+
+/*! Min value of low_water. Smaller values make the stack
+ *  reallocate memory when push and pop alternate.
+ */
+#define MIN_LOW_WATER 3
+
+/*! All options from stack_option_t. */
+#define STACK_ALL_OPTIONS_ (STACK_RETAIN_CAPACITY | STACK_HUGE_PAGES |\
+                            STACK_GUARD_PAGES)
+
+/*! Bits of stack_t::state. */
+#define STATE_EMPLACING_ (1U << 0)
+#define STATE_MAPPED_    (1U << 1)
+#define STATE_GUARDED_   (1U << 2)
+
+/*! Size of huge page which mapped stack data is rounded to. */
+#define HUGE_PAGE_SIZE_ ((size_t) 2 * 1024 * 1024)
+
+
+static size_t increase_capacity (const stack_t *stack, size_t new_size)
 {
-	size_t new_capacity = capacity;
-	if (new_capacity > 256)
-	{
-		new_capacity -= 256;
-	}
-	else
+	size_t capacity = stack->capacity;
+	if (new_size <= capacity)
+		return capacity;
+
+	switch (stack->growth_policy)
 	{
-		new_capacity &= (new_capacity - 1);
+		case GROWTH_DOUBLE:
+			capacity = capacity ? capacity : MIN_CAPACITY;
+			while (capacity < new_size && capacity <= SIZE_MAX / 2)
+				capacity *= 2;
+			break;
+
+		case GROWTH_ONE_AND_HALF:
+			capacity = capacity ? capacity : MIN_CAPACITY;
+			while (capacity < new_size && capacity <= SIZE_MAX / 3)
+				capacity += capacity / 2;
+			break;
+
+		case GROWTH_FIXED_STEP:
+			while (capacity < new_size && capacity <= SIZE_MAX -
+					stack->growth_step)
+				capacity += stack->growth_step;
+			break;
+
+		case GROWTH_CUSTOM:
+			capacity = stack->capacity_func(stack->capacity, new_size);
+			break;
+
+		default:
+			break;
 	}
 
-	if (new_capacity >= new_size)
+	if (capacity < new_size)
+		capacity = new_size;
+
+	return capacity;
+}
+
+
+/* Capacity is reduced only when the stack is much smaller than it
+ * (see low_water), so pushing and popping at the boundary
+ * doesn't reallocate memory. */
+static size_t reduce_capacity (const stack_t *stack, size_t capacity,
+		size_t new_size)
+{
+	size_t old_capacity = capacity;
+
+	if (stack->options & STACK_RETAIN_CAPACITY)
+		return capacity;
+
+	if (stack->growth_policy != GROWTH_CUSTOM &&
+	    new_size > capacity / stack->low_water)
+		return capacity;
+
+	switch (stack->growth_policy)
 	{
-		if ( new_capacity == 0 )
-			return 1;
-		else
-			return new_capacity;
+		case GROWTH_DOUBLE:
+			capacity /= 2;
+			break;
+
+		case GROWTH_ONE_AND_HALF:
+			capacity -= capacity / 3;
+			break;
+
+		case GROWTH_FIXED_STEP:
+			if (capacity - new_size >= 2 * stack->growth_step)
+				capacity -= stack->growth_step;
+			break;
+
+		case GROWTH_CUSTOM:
+			capacity = stack->capacity_func(capacity, new_size);
+			break;
+
+		default:
+			break;
 	}
-	else
-		return capacity;
+
+	if (capacity < new_size || capacity == 0)
+		return old_capacity;
+
+	if (stack->growth_policy != GROWTH_CUSTOM && capacity < MIN_CAPACITY)
+		capacity = old_capacity < MIN_CAPACITY ?
+		           old_capacity : MIN_CAPACITY;
+
+	return capacity;
 }
 
-static size_t increase_capacity (size_t capacity, size_t new_size)
+
+/* Applies reduce_capacity() while it changes something,
+ * because many elements can be removed at once. */
+static size_t fit_capacity (const stack_t *stack, size_t new_size)
 {
-	if (new_size >= capacity)
+	size_t capacity = stack->capacity,
+	       reduced  = reduce_capacity(stack, capacity, new_size);
+
+	while (reduced < capacity)
 	{
-		if (capacity < 256)
-		{
-			if ( (capacity & 1) == 1 )
-				capacity <<= 1;
-			capacity |= capacity - 1;
-		}
-		else
-		{
-			capacity += 256;
-		}
+		capacity = reduced;
+		reduced  = reduce_capacity(stack, capacity, new_size);
 	}
+
 	return capacity;
 }
 
 
+#if CANARIES == ON
+
 static void insert_canary (void *data)
 {
 	*(unsigned long long *) data = CANARY;
 }
 
+#endif
+
 
-static stack_error_t stack_increase_capacity (stack_t* stack, size_t new_capacity)
+/* Guarded data has no right canary, so its elements end
+ * at the upper guard page. */
+static size_t data_length (const stack_t *stack, size_t capacity,
+		bool guarded)
 {
-	size_t need_memory = new_capacity * stack->element_size;
+	size_t length = capacity * stack->element_size;
 	#if CANARIES == ON
-		need_memory += 2 * sizeof CANARY;
+		length += guarded ? sizeof CANARY : 2 * sizeof CANARY;
+	#else
+		(void) guarded;
 	#endif
-	
-	if (stack->data == POISON_PTR)
-		stack->data = NULL;
-
-	void *realloc_check = realloc(stack->data, need_memory);
-	if (!realloc_check)
-		return ALLOCATION_ERROR;
-	stack->data = realloc_check;
+	return length;
+}
 
-	#if CANARIES == ON
-		if (stack->size == 1)
-			insert_canary(stack->data);
-		insert_canary(stack->data + sizeof CANARY +
-		              new_capacity * stack->element_size);
-	#endif
 
-	stack->capacity = new_capacity;
-	return STACK_OK;
+static size_t stack_data_length (const stack_t *stack, size_t capacity)
+{
+	return data_length(stack, capacity, stack->state & STATE_GUARDED_);
 }
 
 
-static void *stack_last_element_ptr(stack_t *stack)
+static void *stack_element_ptr (stack_t *stack, size_t index)
 {
-	void *result = stack->data +
-			(stack->size - 1) * stack->element_size;
+	void *result = stack->data + index * stack->element_size;
 
 	#if CANARIES == ON
 		result += sizeof CANARY;
@@ -115,358 +205,1589 @@ static void *stack_last_element_ptr(stack_t *stack)
 }
 
 
-#if HASH == ON
+static bool stack_use_mmap (const stack_t *stack, size_t length)
+{
+	return (stack->options & STACK_HUGE_PAGES) &&
+	       length >= HUGE_PAGE_THRESHOLD;
+}
 
-#define stack_calculate_hash(STACK_) stack_calculate_hash_func_(STACK_)
 
-uint64_t stack_calculate_hash_func_(stack_t *stack)
+static size_t mapped_length (size_t length)
 {
-	stack->hash = 0;
-	uint64_t hash = (stack->size) % 256;
+	return (length + HUGE_PAGE_SIZE_ - 1) & ~(size_t) (HUGE_PAGE_SIZE_ - 1);
+}
 
-	hash ^= pearson_hash64(stack, sizeof *stack);
 
-	if (stack->size != 0)
-		#if CANARIES == ON
-			hash ^= pearson_hash64(stack->data,
-					stack->capacity + 2 * sizeof CANARY);
-		#else
-			hash ^= pearson_hash64(stack->data,
-					stack->capacity);
-		#endif
+static void *map_data (void *old_data, size_t old_length, size_t length)
+{
+	void *data = MAP_FAILED;
 
-	stack->hash = hash;
+	if (old_data)
+		data = mremap(old_data, mapped_length(old_length),
+				mapped_length(length), MREMAP_MAYMOVE);
+	else
+		data = mmap(NULL, mapped_length(length), PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-	return hash;
-}
+	if (data == MAP_FAILED)
+		return NULL;
 
-#else
+	#ifdef MADV_HUGEPAGE
+		madvise(data, mapped_length(length), MADV_HUGEPAGE);
+	#endif
 
-#define stack_calculate_hash(STACK_)
+	return data;
+}
 
-#endif
 
+static size_t page_size (void)
+{
+	static size_t size = 0;
+	if (!size)
+		size = (size_t) sysconf(_SC_PAGESIZE);
+	return size;
+}
 
-void print_byte (char *dest, const void *byte)
+
+/* Length of the mapping with data of the given length
+ * and one guard page on each side. */
+static size_t guarded_length (size_t length)
 {
-	sprintf(dest, "%X", *(const unsigned char *) byte);
+	size_t page = page_size();
+	return (length + page - 1) / page * page + 2 * page;
 }
 
 
-bool check_stack_data (stack_t *stack, char *str)
+/* Maps data between two PROT_NONE pages. The end of data
+ * is the beginning of the upper guard page. */
+static void *map_guarded_data (size_t length)
 {
-	bool result = true;
-	size_t data_length = stack->element_size * stack->capacity;
-	unsigned char *start = (unsigned char *) stack->data;
+	size_t page = page_size(), total = guarded_length(length);
 
-	#if CANARIES == ON
-	
-		unsigned long long left_canary = *(unsigned long long*)(stack->data),
-			right_canary = *(unsigned long long *) (stack->data
-				+ sizeof CANARY + data_length);
+	unsigned char *base = mmap(NULL, total, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
 
-		sprintf(str, "Left canary = %llx. Right canary = %llx. "
-				"CANARY = %lx", left_canary, right_canary, CANARY);
-		if (left_canary != CANARY || right_canary != CANARY)
-		{
-			add_sublog("Canaries in stack data corrupted!", str,
-					WARNING, 3);
-			result = false;
-		}
-		else
-			add_sublog("Canaries in stack data are good.", str, OK, 3);
+	if (mprotect(base + page, total - 2 * page,
+	             PROT_READ | PROT_WRITE) != 0)
+	{
+		munmap(base, total);
+		return NULL;
+	}
 
-		start += sizeof CANARY;
+	return base + total - page - length;
+}
 
-	#endif
 
-	bool data_good = true;
+/* Returns length of memory between the lower guard page
+ * and guarded data. It is filled with POISON. */
+static size_t guard_slack (const stack_t *stack, unsigned char **begin)
+{
+	size_t page = page_size();
+	*begin = (unsigned char *) ((uintptr_t) stack->data / page * page);
+	return (size_t) ((unsigned char *) stack->data - *begin);
+}
 
-	for (unsigned char *ptr = start + stack->size * stack->element_size;
-			ptr < start + data_length && data_good;
-			ptr += stack->element_size)
-	{
-		if (*ptr != POISON)
-			data_good = false;
-	}
 
-	if (!data_good)
+/* Frees stack data allocated by malloc or by mmap.
+ * State tells how the data was allocated. */
+static void release_data (void *data, size_t length, unsigned state)
+{
+	mem_cache_invalidate(data, length);
+
+	if (state & STATE_GUARDED_)
 	{
-		add_table_log("Data is corrupted!", start, data_length, 1,
-				print_byte, WARNING, 3);
-		return false;
+		size_t total = guarded_length(length);
+		munmap((unsigned char *) data + length + page_size() - total, total);
 	}
-	add_table_log("Data isn't corrupted.", start, data_length, 1,
-			print_byte, OK, 3);
+	else if (state & STATE_MAPPED_)
+		munmap(data, mapped_length(length));
+	else
+		free(data);
+}
 
-	return result;
+
+static void stack_free_data (stack_t *stack)
+{
+	if (stack->data != POISON_PTR && stack->data)
+		release_data(stack->data,
+				stack_data_length(stack, stack->capacity),
+				stack->state);
+
+	stack->state &= ~(STATE_MAPPED_ | STATE_GUARDED_);
 }
 
 
-bool check_hash (stack_t *stack, char *str)
+/* Reallocates stack data. New elements are filled with POISON.
+ * Data of frozen stacks and stacks with STACK_GUARD_PAGES option
+ * is mapped between guard pages. Big buffers of stacks with
+ * STACK_HUGE_PAGES option are mapped with mmap, others are allocated
+ * with realloc. */
+static stack_error_t stack_change_capacity (stack_t* stack, size_t new_capacity)
 {
-	#if HASH == ON
+	unsigned old_state = stack->state;
+	bool   old_guarded = old_state & STATE_GUARDED_,
+	       new_guarded = (stack->options & STACK_GUARD_PAGES) ||
+	                     stack->frozen;
+	size_t need_memory = data_length(stack, new_capacity, new_guarded);
+	size_t old_capacity = stack->capacity;
+	size_t old_length = stack_data_length(stack, old_capacity);
+	void  *old_data = stack->data;
+	bool   old_mapped = old_state & STATE_MAPPED_,
+	       new_mapped = !new_guarded && stack_use_mmap(stack, need_memory);
+	void  *new_data = NULL;
+	
+	if (old_data == POISON_PTR)
+	{
+		old_data = NULL;
+		old_capacity = 0;
+	}
+	else
+		mem_cache_invalidate(old_data, old_length);
 
-		uint64_t old_hash = stack_get_hash(stack);
-		stack_calculate_hash(stack);
+	/* Guarded data is always moved, because its end must stay
+	 * at the guard page. */
+	if (old_data && !old_guarded && !new_guarded && old_mapped == new_mapped)
+	{
+		new_data = new_mapped ? map_data(old_data, old_length, need_memory)
+		                      : realloc(old_data, need_memory);
+		if (!new_data)
+			return ALLOCATION_ERROR;
+	}
+	else
+	{
+		new_data = new_guarded ? map_guarded_data(need_memory) :
+		           new_mapped  ? map_data(NULL, 0, need_memory)
+		                       : malloc(need_memory);
+		if (!new_data)
+			return ALLOCATION_ERROR;
 
-		sprintf(str, "%s->hash = %lu. Must be %lu", stack->name,
-				old_hash, stack->hash);
-		if (stack_get_hash(stack) != old_hash)
+		if (old_data)
 		{
-			add_sublog("Hash incorrect!", str, WARNING, 2);
-			return false;
+			memcpy(new_data, old_data, need_memory < old_length ?
+			                           need_memory : old_length);
+			release_data(old_data, old_length, old_state);
 		}
-		add_sublog("Hash correct.", str, OK, 2);
+	}
 
-	#endif
+	stack->data = new_data;
+	stack->capacity = new_capacity;
 
-	return true;
-}
+	stack->state &= ~(STATE_MAPPED_ | STATE_GUARDED_);
+	if (new_guarded)
+		stack->state |= STATE_GUARDED_;
+	else if (new_mapped)
+		stack->state |= STATE_MAPPED_;
 
+	#if CANARIES == ON
+		insert_canary(stack->data);
+		if (!new_guarded)
+			insert_canary(stack->data + sizeof CANARY +
+			              new_capacity * stack->element_size);
+	#endif
 
+	if (new_guarded)
+	{
+		unsigned char *slack = NULL;
+		size_t slack_length = guard_slack(stack, &slack);
+		poison_fill(slack, POISON, slack_length);
+	}
 
+	if (new_capacity > old_capacity)
+		poison_fill(stack_element_ptr(stack, old_capacity), POISON,
+		            (new_capacity - old_capacity) * stack->element_size);
 
-/*=================== Global functions ===================*/
+	return STACK_OK;
+}
 
 
-stack_t *stack_create_func_ (const char *name, size_t element_size)
+/* Changes protection of pages with stack data. Data of frozen
+ * stacks is mapped, so the pages don't contain other memory. */
+static int stack_protect_data (stack_t *stack, int prot)
 {
-	#if VALIDATION == ON
+	if (stack->data == POISON_PTR)
+		return 0;
 
-	if_log (element_size <= 0, ERROR)
-		return NULL;
-	
-	#endif
+	size_t    length = stack_data_length(stack, stack->capacity);
+	uintptr_t page   = page_size(),
+	          begin  = (uintptr_t) stack->data / page * page,
+	          end    = 0;
 
-	stack_t *stack_ptr = (stack_t *) calloc(sizeof *stack_ptr, 1);
-	
-	if (stack_ptr)
-		*stack_ptr = stack_constructor_func_(name, element_size);
-	
-	return stack_ptr;
+	if (stack->state & STATE_GUARDED_)
+		end = (uintptr_t) stack->data + length;
+	else
+		end = begin + mapped_length(length);
+
+	return mprotect((void *) begin, end - begin, prot);
 }
 
 
-stack_t stack_constructor_func_ (const char *name, size_t element_size)
+static void stack_release_frozen (stack_t *stack)
 {
-	stack_t stack;
-
-	#if VALIDATION == OK
-
-	if_log (element_size <= 0, ERROR)
-		element_size = 1;
+	mem_cache_invalidate(stack->frozen, sizeof *stack);
+	munmap((void *) stack->frozen, page_size());
+	stack->frozen = NULL;
+}
 
-	if_log (is_bad_ptr(name), ERROR)
-		stack.name = "UNKNOWN";
 
-	#endif	
+#if HASH == ON
 
-	strcpy(stack.name, name);
-	stack.data         = POISON_PTR;
-	stack.element_size = element_size;
-	stack.size         = 0;
-	stack.capacity     = 1;
+#define stack_calculate_hash(STACK_) stack_calculate_hash_func_(STACK_)
 
+static uint64_t stack_slot_hash (stack_t *stack, size_t index)
+{
+	const void *slot = stack->data + index * stack->element_size;
 	#if CANARIES == ON
-		stack.left_canary = stack.right_canary = CANARY;
+		slot += sizeof CANARY;
 	#endif
 
-	stack_calculate_hash(&stack);
-
-	return stack;
+	return stack_slot_hash_mix_(HASH_FUNCTION(slot, stack->element_size),
+			index);
 }
 
 
-stack_error_t stack_delete (stack_t *stack_ptr)
+static uint64_t stack_calculate_data_hash (stack_t *stack)
 {
-	stack_error_t error = STACK_OK;
-	if (stack_ptr)
-	{
-		error = stack_deconstructor(stack_ptr);
-		free(stack_ptr);
-	}
-	return error;
+	uint64_t hash = 0;
+	for (size_t i = 0; i < stack->size; ++i)
+		hash ^= stack_slot_hash(stack, i);
+	return hash;
 }
 
 
-stack_error_t stack_deconstructor (stack_t *stack)
+/* Hashes only elements pushed after the last check
+ * and takes the hash of older ones from it. */
+static uint64_t stack_calculate_dirty_hash (stack_t *stack)
 {
-	#if VALIDATION == ON
-
-	stack_error_t error = stack_check(stack);
-	
-	if (error == STACK_OK)
-	{
+	uint64_t hash = stack->verified_hash;
+	for (size_t i = stack->verified_size; i < stack->size; ++i)
+		hash ^= stack_slot_hash(stack, i);
+	return hash;
+}
 
-	#endif
 
-		stack->size     = 1;
-		stack->capacity = 0;
-		
-		if (stack->data != POISON_PTR)
-		{
-			free(stack->data);
-			stack->data = NULL;
-		}
+uint64_t stack_calculate_hash_func_(stack_t *stack)
+{
+	/* check_counter is changed by reading operations,
+	 * so it isn't hashed. */
+	size_t check_counter = stack->check_counter;
 
-		return STACK_OK;
+	stack->hash = 0;
+	stack->check_counter = 0;
+	uint64_t hash = (stack->size) % 256;
 
-	#if VALIDATION == ON
+	hash ^= HASH_FUNCTION(stack, sizeof *stack);
 
-	}
-	return error;
+	stack->hash = hash;
+	stack->check_counter = check_counter;
 
-	#endif
+	return hash;
 }
 
 
-stack_error_t stack_check_func_ (stack_t *stack, _CODE_POSITION_T_)
-{
-	(void) fname, (void) func, (void) line;
+#if INCREMENTAL_HASH == ON
 
-	bool error = false;
-	char str[200];
+/* Folds the hash of the element in or out of the data hash. */
+#define stack_fold_data_hash(STACK_, SLOT_HASH_) \
+	((STACK_)->data_hash ^= (SLOT_HASH_))
 
-	if (is_bad_ptr(stack))
-	{
-		sprintf(str, "stack_t *unknown = %p", stack);
-		write_log("Pointer to stack is bad!", str, ERROR, 0);
-		return INVALID_PTR;
-	}
+#define stack_update_data_hash(STACK_, INDEX_) \
+	stack_fold_data_hash(STACK_, stack_slot_hash(STACK_, INDEX_))
 
-	if (is_bad_ptr(stack->name))
-	{
-		sprintf(str, "stack_t *unknown; unknown->name = %p", stack->name);
-		write_log("Pointer of ame of stack is bad!", str, ERROR, 0);
-		return INVALID_PTR;
-	}
+#define stack_recalculate_data_hash(STACK_) (void) 0
 
-	sprintf(str, "stack_t %s", stack->name);
-	multilog_begin_at("Stack checking...", str, _CODE_POSITION_);
+#else
 
-	sprintf(str, "%s = %p", stack->name, stack);
-	add_sublog("Pointer to stack is good.", str, OK, 1);
+#define stack_fold_data_hash(STACK_, SLOT_HASH_) (void) (SLOT_HASH_)
 
-	sprintf(str, "%s->name = %p", stack->name, stack->name);
-	add_sublog("Pointer to name of stack is good.", str, OK, 2);
+#define stack_update_data_hash(STACK_, INDEX_) (void) 0
 
-	sprintf(str, "%s->element_size = %zd", stack->name, stack->element_size);
-	if (stack->element_size == 0)
-	{
-		add_sublog("Element size incorrect!", str, ERROR, 2);
-		error = true;
-	}
-	add_sublog("Element size is good.", str, OK, 2);
+#define stack_recalculate_data_hash(STACK_) \
+	((STACK_)->data_hash = stack_calculate_data_hash(STACK_))
 
-	sprintf(str, "%s->size = %zd, %s->capacity = %zd",
-			stack->name, stack->size, stack->name, stack->capacity);
-	if ((stack->size == 0 && stack->capacity != 1) || stack->capacity == 0)
-	{
-		add_sublog("Size or capacity incorrect!", str, ERROR, 2);
-		error = true;
-	}
-	add_sublog("Size and capacity values are good.", str, OK, 2);
+#endif
 
-	size_t stack_length = stack->capacity;
+#else
 
-	#if CANARIES == ON
-		
-		stack_length += 2 * sizeof CANARY;
+#define stack_calculate_hash(STACK_)
 
-		sprintf(str, "%s->left_canary = %llx, %s->right_canary = %llx, "
-				"CANARY = %lx", stack->name, stack->left_canary,
-				stack->name, stack->right_canary, CANARY);
-		if (stack->left_canary != CANARY || stack->right_canary != CANARY)
-		{
-			add_sublog("Canaries incorrect!", str, WARNING, 2);
-			error = true;
-		}
-		add_sublog("Canaries are good.", str, OK, 2);
-	
-	#endif
+#define stack_fold_data_hash(STACK_, SLOT_HASH_) (void) (SLOT_HASH_)
 
-	sprintf(str, "%s->data = %p", stack->name, stack->data);
-	if ((stack->size == 0 && stack->data != POISON_PTR) ||
-	     (stack->size > 0 && is_bad_mem(stack->data, stack_length)))
-	{
-		add_sublog("Pointer to stack data is bad!", str, ERROR, 2);
-		multilog_end(WARNING);
-		return INVALID_DATA_PTR;
-	}
-	add_sublog("Pointer to stack data is good.", str, OK, 2);
+#define stack_update_data_hash(STACK_, INDEX_) (void) 0
 
-	if (stack->size > 0)
-		error = ! check_stack_data(stack, str);
-	
-	error = ! check_hash(stack, str);
+#define stack_recalculate_data_hash(STACK_) (void) 0
 
-	multilog_end(WARNING);
+#endif
 
-	if (error)
-		return SOME_ERROR;
-	else
-		return STACK_OK;
+
+void print_byte (char *dest, const void *byte)
+{
+	sprintf(dest, "%X", *(const unsigned char *) byte);
 }
 
 
-stack_error_t stack_top (stack_t *stack, void *result)
+/* Writes result of one check to the multilog. Strings are formatted
+ * only by verbose checks, so successful quiet checks cost nothing.
+ * Nothing is formatted if the log level filters the result out. */
+#define report_check(FAILED_, BAD_MSG_, DANGER_, GOOD_MSG_, DEEP_LVL_, ...) \
+{\
+	if (verbose && log_level_enabled((FAILED_) ? (DANGER_) : OK))\
+	{\
+		sprintf(str, __VA_ARGS__);\
+		if (FAILED_)\
+		{\
+			add_sublog(BAD_MSG_, str, DANGER_, DEEP_LVL_);\
+		}\
+		else\
+		{\
+			add_sublog(GOOD_MSG_, str, OK, DEEP_LVL_);\
+		}\
+	}\
+} (void) 0
+
+
+bool check_stack_data (stack_t *stack, char *str, validation_level_t level,
+		bool forced, bool verbose)
 {
-	#if VALIDATION == ON
-
-		if_log (is_bad_ptr(stack), ERROR)
+	bool result = true;
+	size_t data_length = stack->element_size * stack->capacity;
+	unsigned char *start = (unsigned char *) stack->data;
+
+	#if CANARIES == ON
+	
+	/* The upper guard page protects guarded data instead
+	 * of the right canary. */
+	if (level >= VALIDATION_CANARIES)
+	{
+		unsigned long long left_canary = *(unsigned long long*)(stack->data),
+			right_canary = CANARY;
+		if (!(stack->state & STATE_GUARDED_))
+			right_canary = *(unsigned long long *) (stack->data
+				+ sizeof CANARY + data_length);
+
+		bool failed = left_canary != CANARY || right_canary != CANARY;
+		report_check(failed, "Canaries in stack data corrupted!", WARNING,
+				"Canaries in stack data are good.", 3,
+				"Left canary = %llx. Right canary = %llx. "
+				"CANARY = %lx", left_canary, right_canary, CANARY);
+		if (failed)
+			result = false;
+	}
+
+	start += sizeof CANARY;
+
+	#else
+
+		(void) str;
+
+	#endif
+
+	if (level < VALIDATION_FULL)
+		return result;
+
+	size_t used = stack->size;
+	if (stack->state & STATE_EMPLACING_)
+		used++;
+
+	/* Every byte of unused elements which can be poisoned after
+	 * the last check is checked. */
+	size_t dirty = forced ? stack->capacity : stack->dirty_top;
+	if (dirty > stack->capacity)
+		dirty = stack->capacity;
+
+	size_t used_length  = used  * stack->element_size,
+	       dirty_length = dirty * stack->element_size;
+	bool data_good = used_length >= dirty_length ||
+	                 poison_verify(start + used_length, POISON,
+	                               dirty_length - used_length);
+
+	/* Nothing changes memory below guarded data,
+	 * so it is checked only by full checks. */
+	if (forced && (stack->state & STATE_GUARDED_))
+	{
+		unsigned char *slack = NULL;
+		size_t slack_length = guard_slack(stack, &slack);
+
+		bool failed = !poison_verify(slack, POISON, slack_length);
+		report_check(failed, "Memory below stack data corrupted!", WARNING,
+				"Memory below stack data is good.", 3,
+				"%zu bytes from %p", slack_length, (void *) slack);
+		if (failed)
+			result = false;
+	}
+
+	if (verbose)
+	{
+		if (!data_good)
+		{
+			add_table_log("Data is corrupted!", start, data_length, 1,
+					print_byte, WARNING, 3);
+		}
+		else
+		{
+			add_table_log("Data isn't corrupted.", start, data_length, 1,
+					print_byte, OK, 3);
+		}
+	}
+
+	return result && data_good;
+}
+
+
+/* Only verbose check repairs the hash, so that the error is reported
+ * once and next operations can work with the stack. */
+bool check_hash (stack_t *stack, char *str, validation_level_t level,
+		bool forced, bool verbose)
+{
+	#if HASH == ON
+
+		bool result = true;
+
+		if (level >= VALIDATION_FULL)
+		{
+			uint64_t data_hash = forced ? stack_calculate_data_hash(stack) :
+			                     stack_calculate_dirty_hash(stack);
+
+			bool failed = data_hash != stack->data_hash;
+			report_check(failed, "Data hash incorrect!", WARNING,
+					"Data hash correct.", 2,
+					"%s->data_hash = %lu. Must be %lu", stack->name,
+					stack->data_hash, data_hash);
+			if (failed)
+			{
+				if (verbose)
+				{
+					stack->data_hash = data_hash;
+					stack_calculate_hash(stack);
+				}
+				return false;
+			}
+		}
+
+		uint64_t old_hash = stack_get_hash(stack);
+		stack_calculate_hash(stack);
+		uint64_t new_hash = stack_get_hash(stack);
+
+		if (!verbose)
+			stack->hash = old_hash;
+
+		bool failed = new_hash != old_hash;
+		report_check(failed, "Hash incorrect!", WARNING, "Hash correct.", 2,
+				"%s->hash = %lu. Must be %lu", stack->name,
+				old_hash, new_hash);
+		if (failed)
+			result = false;
+
+		return result;
+
+	#else
+
+		(void) stack, (void) str, (void) level, (void) forced,
+		(void) verbose;
+
+	#endif
+
+	return true;
+}
+
+
+/* Checks the stack as deep as the level says. Memory verified
+ * by previous checks is checked only if forced is true. Logs are written
+ * only if verbose is true. */
+static stack_error_t stack_check_pass (stack_t *stack,
+		validation_level_t level, bool forced, bool verbose,
+		_CODE_POSITION_T_)
+{
+	(void) fname, (void) func, (void) line;
+
+	bool error = false, failed = false;
+	char str[200];
+
+	if (is_bad_ptr(stack))
+	{
+		if (verbose)
+		{
+			sprintf(str, "stack_t *unknown = %p", stack);
+			write_log("Pointer to stack is bad!", str, ERROR, 0);
+		}
+		return INVALID_PTR;
+	}
+
+	if (level == VALIDATION_NONE)
+		return STACK_OK;
+
+	if (is_bad_ptr(stack->name))
+	{
+		if (verbose)
+		{
+			sprintf(str, "stack_t *unknown; unknown->name = %p",
+					stack->name);
+			write_log("Pointer of ame of stack is bad!", str, ERROR, 0);
+		}
+		return INVALID_PTR;
+	}
+
+	if (verbose)
+	{
+		sprintf(str, "stack_t %s", stack->name);
+		multilog_begin_at("Stack checking...", str, _CODE_POSITION_);
+	}
+
+	report_check(false, "", OK, "Pointer to stack is good.", 1,
+			"%s = %p", stack->name, stack);
+
+	report_check(false, "", OK, "Pointer to name of stack is good.", 2,
+			"%s->name = %p", stack->name, stack->name);
+
+	failed = stack->element_size == 0;
+	report_check(failed, "Element size incorrect!", ERROR,
+			"Element size is good.", 2,
+			"%s->element_size = %zd", stack->name, stack->element_size);
+	error |= failed;
+
+	failed = stack->size > stack->capacity ||
+	         ((stack->state & STATE_EMPLACING_) &&
+	          stack->size == stack->capacity);
+	#if HASH == ON
+		failed |= stack->verified_size > stack->size;
+	#endif
+	report_check(failed, "Size or capacity incorrect!", ERROR,
+			"Size and capacity values are good.", 2,
+			"%s->size = %zd, %s->capacity = %zd",
+			stack->name, stack->size, stack->name, stack->capacity);
+	error |= failed;
+
+	failed = stack->growth_policy > GROWTH_CUSTOM ||
+	         (stack->growth_policy == GROWTH_FIXED_STEP &&
+	          stack->growth_step == 0) ||
+	         (stack->growth_policy == GROWTH_CUSTOM && !stack->capacity_func);
+	report_check(failed, "Growth policy incorrect!", ERROR,
+			"Growth policy is good.", 2,
+			"%s->growth_policy = %d, growth_step = %zd, "
+			"capacity_func = %p", stack->name, (int) stack->growth_policy,
+			stack->growth_step, (void *) stack->capacity_func);
+	error |= failed;
+
+	failed = stack->low_water < MIN_LOW_WATER ||
+	         (stack->options & ~STACK_ALL_OPTIONS_);
+	report_check(failed, "Shrink policy or options incorrect!", ERROR,
+			"Shrink policy and options are good.", 2,
+			"%s->low_water = %zd, %s->options = %x", stack->name,
+			stack->low_water, stack->name, stack->options);
+	error |= failed;
+
+	failed = stack->validation_level > VALIDATION_FULL;
+	report_check(failed, "Validation level incorrect!", ERROR,
+			"Validation level is good.", 2,
+			"%s->validation_level = %d, %s->check_period = %zd",
+			stack->name, (int) stack->validation_level,
+			stack->name, stack->check_period);
+	error |= failed;
+
+	#if CANARIES == ON
+		
+		failed = stack->left_canary != CANARY ||
+		         stack->right_canary != CANARY;
+		report_check(failed, "Canaries incorrect!", WARNING,
+				"Canaries are good.", 2,
+				"%s->left_canary = %llx, %s->right_canary = %llx, "
+				"CANARY = %lx", stack->name, stack->left_canary,
+				stack->name, stack->right_canary, CANARY);
+		error |= failed;
+	
+	#endif
+
+	failed = (stack->capacity == 0) != (stack->data == POISON_PTR) ||
+	         (stack->capacity > 0 && is_bad_mem(stack->data,
+			stack_data_length(stack, stack->capacity)));
+	report_check(failed, "Pointer to stack data is bad!", ERROR,
+			"Pointer to stack data is good.", 2,
+			"%s->data = %p", stack->name, stack->data);
+	if (failed)
+	{
+		if (verbose)
+		{
+			multilog_end(WARNING);
+		}
+		return INVALID_DATA_PTR;
+	}
+
+	if (stack->capacity > 0 &&
+	    !check_stack_data(stack, str, level, forced, verbose))
+		error = true;
+	
+	if (!check_hash(stack, str, level, forced, verbose))
+		error = true;
+
+	if (verbose)
+	{
+		multilog_end(WARNING);
+	}
+
+	if (error)
+		return SOME_ERROR;
+	else
+		return STACK_OK;
+}
+
+
+/* Remembers which memory is verified by the check of the stack at
+ * VALIDATION_FULL level. After a failed check everything is verified
+ * again. */
+static void stack_mark_verified (stack_t *stack, stack_error_t error)
+{
+	size_t used = stack->size;
+	if (stack->state & STATE_EMPLACING_)
+		used++;
+
+	size_t dirty_top = error == STACK_OK ? used : stack->capacity;
+
+	#if HASH == ON
+
+		size_t   verified_size = error == STACK_OK ? stack->size : 0;
+		uint64_t verified_hash = error == STACK_OK ? stack->data_hash : 0;
+
+		if (stack->verified_size == verified_size &&
+		    stack->verified_hash == verified_hash &&
+		    stack->dirty_top == dirty_top)
+			return;
+
+		stack->verified_size = verified_size;
+		stack->verified_hash = verified_hash;
+
+	#else
+
+		if (stack->dirty_top == dirty_top)
+			return;
+
+	#endif
+
+	stack->dirty_top = dirty_top;
+	stack_calculate_hash(stack);
+}
+
+
+/* Data of the frozen stack can't be changed, so only stack_t
+ * is compared with its read-only copy. */
+static stack_error_t stack_check_frozen (stack_t *stack, _CODE_POSITION_T_)
+{
+	(void) fname, (void) func, (void) line;
+
+	stack_error_t error = STACK_OK;
+
+	if (is_bad_ptr(stack->frozen))
+		error = INVALID_PTR;
+	else if (memcmp(stack, stack->frozen, sizeof *stack) != 0)
+		error = SOME_ERROR;
+
+	if (error != STACK_OK && log_level_enabled(ERROR))
+	{
+		char str[200];
+		sprintf(str, "stack_t %s; copy of frozen stack = %p",
+				stack->name, (const void *) stack->frozen);
+		write_log_at("Frozen stack is changed!", str, ERROR, 0,
+				_CODE_POSITION_);
+	}
+
+	return error;
+}
+
+
+/* Checks the stack without logging and repeats the check
+ * with logging only if something is wrong. The repeated check verifies
+ * all memory of the stack. */
+static stack_error_t stack_check_level (stack_t *stack,
+		validation_level_t level, bool forced, _CODE_POSITION_T_)
+{
+	if (level > VALIDATION_NONE && !is_bad_ptr(stack) && stack->frozen)
+		return stack_check_frozen(stack, _CODE_POSITION_);
+
+	stack_error_t error = stack_check_pass(stack, level, forced, false,
+			_CODE_POSITION_);
+
+	if (error != STACK_OK)
+		error = stack_check_pass(stack, level, true, true,
+				_CODE_POSITION_);
+
+	if (level == VALIDATION_FULL &&
+	    (error == STACK_OK || error == SOME_ERROR))
+		stack_mark_verified(stack, error);
+
+	return error;
+}
+
+
+#if VALIDATION == ON
+
+#define stack_validate(STACK_) stack_validate_func_(STACK_,\
+		_CURRENT_CODE_POSITION_)
+
+/* Checks the stack before an operation according to its validation level.
+ * Every check_period-th operation checks all memory of the stack. */
+static stack_error_t stack_validate_func_ (stack_t *stack, _CODE_POSITION_T_)
+{
+	if (is_bad_ptr(stack))
+		return stack_check_level(stack, VALIDATION_FULL, false,
+				_CODE_POSITION_);
+
+	validation_level_t level = stack->validation_level;
+	bool forced = false;
+
+	/* The counter is a part of the frozen stack. */
+	if (!stack->frozen && stack->check_period > 0 &&
+	    ++stack->check_counter >= stack->check_period)
+	{
+		stack->check_counter = 0;
+		level  = VALIDATION_FULL;
+		forced = true;
+	}
+
+	if (level > VALIDATION_FULL)
+		level = VALIDATION_FULL;
+
+	return stack_check_level(stack, level, forced, _CODE_POSITION_);
+}
+
+#endif
+
+
+
+
+/* Removes count elements from the top of the stack,
+ * which are already poisoned and folded out of the data hash. */
+static void stack_drop_elements (stack_t *stack, size_t count)
+{
+	if (stack->dirty_top < stack->size)
+		stack->dirty_top = stack->size;
+
+	stack->size -= count;
+	stack_recalculate_data_hash(stack);
+
+	#if HASH == ON
+		/* All the rest elements are verified. */
+		if (stack->verified_size > stack->size)
+		{
+			stack->verified_size = stack->size;
+			stack->verified_hash = stack->data_hash;
+		}
+	#endif
+	
+	size_t new_capacity = fit_capacity(stack, stack->size);
+
+	/* If memory can't be shrinked the stack keeps old buffer. */
+	if (new_capacity != stack->capacity)
+		stack_change_capacity(stack, new_capacity);
+
+	stack_calculate_hash(stack);
+}
+
+
+/* Removes count elements from the top of the stack,
+ * poisons their memory and updates the hash. */
+static void stack_remove_elements (stack_t *stack, size_t count)
+{
+	for (size_t i = stack->size - count; i < stack->size; ++i)
+		stack_update_data_hash(stack, i);
+
+	void *first_element = stack_element_ptr(stack, stack->size - count);
+	poison_fill(first_element, POISON, count * stack->element_size);
+
+	stack_drop_elements(stack, count);
+}
+
+
+/* Checks made by stack_push_commit() and stack_push_finish_(). */
+static stack_error_t stack_check_push_commit (stack_t *stack)
+{
+	#if VALIDATION == ON
+
+		if_log (is_bad_ptr(stack), ERROR)
+			return INVALID_PTR;
+
+		if_log (stack->state & STATE_EMPLACING_, ERROR)
+			return EMPLACE_ERROR;
+
+		if_log (stack->size >= stack->capacity, ERROR)
+			return SOME_ERROR;
+
+	#endif
+
+	if_log (stack->frozen, ERROR)
+		return STACK_FROZEN;
+
+	return STACK_OK;
+}
+
+
+/* Checks made by stack_pop_commit() and stack_pop_finish_(). */
+static stack_error_t stack_check_pop_commit (stack_t *stack)
+{
+	#if VALIDATION == ON
+
+		if_log (is_bad_ptr(stack), ERROR)
+			return INVALID_PTR;
+
+		if_log (stack->state & STATE_EMPLACING_, ERROR)
+			return EMPLACE_ERROR;
+
+	#endif
+
+	if_log (stack->frozen, ERROR)
+		return STACK_FROZEN;
+
+	if (stack_size(stack) == 0)
+		return STACK_EMPTY;
+
+	return STACK_OK;
+}
+
+
+
+
+/*=================== Global functions ===================*/
+
+
+stack_t *stack_create_func_ (const char *name, size_t element_size)
+{
+	return stack_create_reserved_func_(name, element_size, 0);
+}
+
+
+stack_t *stack_create_reserved_func_ (const char *name, size_t element_size,
+		size_t capacity)
+{
+	#if VALIDATION == ON
+
+	if_log (element_size <= 0, ERROR)
+		return NULL;
+	
+	#endif
+
+	stack_t *stack_ptr = (stack_t *) calloc(sizeof *stack_ptr, 1);
+	
+	if (stack_ptr)
+		*stack_ptr = stack_constructor_reserved_func_(name, element_size,
+				capacity);
+	
+	return stack_ptr;
+}
+
+
+stack_t stack_constructor_func_ (const char *name, size_t element_size)
+{
+	return stack_constructor_reserved_func_(name, element_size, 0);
+}
+
+
+stack_t stack_constructor_reserved_func_ (const char *name,
+		size_t element_size, size_t capacity)
+{
+	stack_t stack;
+	memset(&stack, 0, sizeof stack);
+
+	#if VALIDATION == ON
+
+	if_log (element_size <= 0, ERROR)
+		element_size = 1;
+
+	if_log (is_bad_ptr(name), ERROR)
+		name = "UNKNOWN";
+
+	#endif	
+
+	strncpy(stack.name, name, sizeof stack.name - 1);
+	stack.data         = POISON_PTR;
+	stack.element_size = element_size;
+	stack.size         = 0;
+	stack.capacity     = 0;
+
+	stack.growth_policy = DEFAULT_GROWTH_POLICY;
+	stack.growth_step   = DEFAULT_GROWTH_STEP;
+	stack.capacity_func = NULL;
+	stack.low_water     = DEFAULT_SHRINK_LOW_WATER;
+	stack.options       = DEFAULT_STACK_OPTIONS;
+	stack.state         = 0;
+
+	stack.validation_level = DEFAULT_VALIDATION_LEVEL;
+	stack.check_period     = DEFAULT_CHECK_PERIOD;
+	stack.check_counter    = 0;
+	stack.dirty_top        = 0;
+
+	#if CANARIES == ON
+		stack.left_canary = stack.right_canary = CANARY;
+	#endif
+
+	#if HASH == ON
+		stack.data_hash     = 0;
+		stack.verified_size = 0;
+		stack.verified_hash = 0;
+	#endif
+
+	stack.frozen = NULL;
+
+	if (capacity > 0)
+	{
+		if_log (stack_change_capacity(&stack, capacity) != STACK_OK, ERROR)
+			stack.capacity = 0;
+	}
+
+	stack_calculate_hash(&stack);
+
+	return stack;
+}
+
+
+stack_error_t stack_delete (stack_t *stack_ptr)
+{
+	stack_error_t error = STACK_OK;
+	if (stack_ptr)
+	{
+		error = stack_deconstructor(stack_ptr);
+		mem_cache_invalidate(stack_ptr, sizeof *stack_ptr);
+		free(stack_ptr);
+	}
+	return error;
+}
+
+
+stack_error_t stack_deconstructor (stack_t *stack)
+{
+	#if VALIDATION == ON
+
+	stack_error_t error = stack_check(stack);
+	
+	if (error == STACK_OK)
+	{
+
+	#endif
+
+		if (stack->frozen)
+			stack_release_frozen(stack);
+
+		/* Length of the buffer is calculated from capacity,
+		 * so data is freed before capacity is reset. */
+		if (stack->data != POISON_PTR)
+		{
+			stack_free_data(stack);
+			stack->data = NULL;
+		}
+
+		stack->size     = 1;
+		stack->capacity = 0;
+
+		return STACK_OK;
+
+	#if VALIDATION == ON
+
+	}
+	return error;
+
+	#endif
+}
+
+
+stack_error_t stack_check_func_ (stack_t *stack, _CODE_POSITION_T_)
+{
+	return stack_check_level(stack, VALIDATION_FULL, false, _CODE_POSITION_);
+}
+
+
+stack_error_t stack_check_full_func_ (stack_t *stack, _CODE_POSITION_T_)
+{
+	return stack_check_level(stack, VALIDATION_FULL, true, _CODE_POSITION_);
+}
+
+
+stack_error_t stack_top (stack_t *stack, void *result)
+{
+	return stack_peek_n(stack, result, 1);
+}
+
+
+stack_error_t stack_pop (stack_t *stack, void *result)
+{
+	stack_error_t error = STACK_OK;
+	const void *top = stack_pop_begin(stack, &error);
+	if (!top)
+		return error;
+
+	#if VALIDATION == ON
+
+		if_log (is_bad_mem(result, stack->element_size), ERROR)
+			return INVALID_PTR;
+
+	#endif
+
+	memcpy(result, top, stack->element_size);
+
+	return stack_pop_commit(stack);
+}
+
+
+stack_error_t stack_push (stack_t *stack, const void *pushed_value)
+{
+	#if VALIDATION == ON
+
+		/* The value is checked before the stack is changed. */
+		if_log (!is_bad_ptr(stack) &&
+				is_bad_mem(pushed_value, stack->element_size), WARNING)
+			return INVALID_PTR;
+
+	#endif
+
+	stack_error_t error = STACK_OK;
+	void *slot = stack_push_begin(stack, &error);
+	if (!slot)
+		return error;
+
+	memcpy(slot, pushed_value, stack->element_size);
+
+	return stack_push_commit(stack);
+}
+
+
+stack_error_t stack_peek_n (stack_t *stack, void *result, size_t count)
+{
+	#if VALIDATION == ON
+
+		if_log (is_bad_ptr(stack), ERROR)
+			return INVALID_PTR;
+
+		stack_error_t error = stack_validate(stack);
+		if ( error != STACK_OK )
+			return error;
+
+		if_log (count > 0 && is_bad_mem(result,
+				count * stack->element_size), ERROR)
+			return INVALID_PTR;
+
+	#endif
+
+	if (stack_size(stack) < count)
+		return STACK_EMPTY;
+	if (count == 0)
+		return STACK_OK;
+
+	void *first_element = stack_element_ptr(stack, stack->size - count);
+	memcpy(result, first_element, count * stack->element_size);
+
+	return STACK_OK;
+}
+
+
+stack_error_t stack_pop_n (stack_t *stack, void *result, size_t count)
+{
+	stack_error_t error = stack_peek_n(stack, result, count);
+
+	#if VALIDATION == ON
+
+		if_log (error == STACK_OK && (stack->state & STATE_EMPLACING_),
+				ERROR)
+			return EMPLACE_ERROR;
+
+	#endif
+
+	if_log (error == STACK_OK && stack->frozen, ERROR)
+		return STACK_FROZEN;
+
+	if (error != STACK_OK || count == 0)
+		return error;
+
+	stack_remove_elements(stack, count);
+
+	return STACK_OK;
+}
+
+
+stack_error_t stack_push_n (stack_t *stack, const void *values, size_t count)
+{
+	#if VALIDATION == ON
+	
+		if_log (is_bad_ptr(stack), ERROR)
+			return INVALID_PTR;
+
+		stack_error_t error = stack_validate(stack);
+
+		if (error != STACK_OK)
+			return error;
+
+		if_log (count > 0 && is_bad_mem(values,
+				count * stack->element_size), WARNING)
+			return INVALID_PTR;
+
+		if_log (stack->state & STATE_EMPLACING_, ERROR)
+			return EMPLACE_ERROR;
+
+	#endif
+
+	if_log (stack->frozen, ERROR)
+		return STACK_FROZEN;
+
+	if (count == 0)
+		return STACK_OK;
+
+	if (count > SIZE_MAX / stack->element_size - stack->size)
+		return ALLOCATION_ERROR;
+
+	size_t new_capacity = increase_capacity(stack, stack->size + count);
+
+	if (new_capacity != stack->capacity &&
+	    stack_change_capacity(stack, new_capacity) != STACK_OK)
+		return ALLOCATION_ERROR;
+
+	void *first_element = stack_element_ptr(stack, stack->size);
+	memcpy(first_element, values, count * stack->element_size);
+
+	stack->size += count;
+
+	for (size_t i = stack->size - count; i < stack->size; ++i)
+		stack_update_data_hash(stack, i);
+	stack_recalculate_data_hash(stack);
+	stack_calculate_hash(stack);
+
+	return STACK_OK;
+}
+
+
+const void *stack_top_ptr (stack_t *stack, stack_error_t *error)
+{
+	stack_error_t result = STACK_OK;
+
+	#if VALIDATION == ON
+
+		if_log (is_bad_ptr(stack), ERROR)
+			result = INVALID_PTR;
+		else
+			result = stack_validate(stack);
+
+	#endif
+
+	if (result == STACK_OK && !stack_size(stack))
+		result = STACK_EMPTY;
+
+	if (error)
+		*error = result;
+
+	if (result != STACK_OK)
+		return NULL;
+
+	return stack_element_ptr(stack, stack->size - 1);
+}
+
+
+void *stack_push_begin (stack_t *stack, stack_error_t *error)
+{
+	stack_error_t result = STACK_OK;
+
+	#if VALIDATION == ON
+
+		if_log (is_bad_ptr(stack), ERROR)
+			result = INVALID_PTR;
+		else
+			result = stack_validate(stack);
+
+		if_log (result == STACK_OK &&
+				(stack->state & STATE_EMPLACING_), ERROR)
+			result = EMPLACE_ERROR;
+
+	#endif
+
+	if_log (result == STACK_OK && stack->frozen, ERROR)
+		result = STACK_FROZEN;
+
+	if (result == STACK_OK)
+	{
+		size_t new_capacity = increase_capacity(stack, stack->size + 1);
+
+		if (new_capacity != stack->capacity)
+		{
+			/* The stack is consistent even if push isn't committed. */
+			if (stack_change_capacity(stack, new_capacity) != STACK_OK)
+			{
+				result = ALLOCATION_ERROR;
+			}
+			else
+			{
+				stack_calculate_hash(stack);
+			}
+		}
+	}
+
+	if (error)
+		*error = result;
+
+	if (result != STACK_OK)
+		return NULL;
+
+	return stack_element_ptr(stack, stack->size);
+}
+
+
+stack_error_t stack_push_commit (stack_t *stack)
+{
+	stack_error_t error = stack_check_push_commit(stack);
+	if (error != STACK_OK)
+		return error;
+
+	stack->size++;
+
+	stack_update_data_hash(stack, stack->size - 1);
+	stack_recalculate_data_hash(stack);
+	stack_calculate_hash(stack);
+
+	return STACK_OK;
+}
+
+
+stack_error_t stack_push_finish_ (stack_t *stack, uint64_t slot_hash)
+{
+	stack_error_t error = stack_check_push_commit(stack);
+	if (error != STACK_OK)
+		return error;
+
+	stack->size++;
+
+	stack_fold_data_hash(stack, slot_hash);
+	stack_recalculate_data_hash(stack);
+	stack_calculate_hash(stack);
+
+	return STACK_OK;
+}
+
+
+const void *stack_pop_begin (stack_t *stack, stack_error_t *error)
+{
+	stack_error_t result = STACK_OK;
+	const void *top = stack_top_ptr(stack, &result);
+
+	#if VALIDATION == ON
+
+		if_log (top && (stack->state & STATE_EMPLACING_), ERROR)
+		{
+			result = EMPLACE_ERROR;
+			top    = NULL;
+		}
+
+	#endif
+
+	if_log (top && stack->frozen, ERROR)
+	{
+		result = STACK_FROZEN;
+		top    = NULL;
+	}
+
+	if (error)
+		*error = result;
+
+	return top;
+}
+
+
+stack_error_t stack_pop_commit (stack_t *stack)
+{
+	stack_error_t error = stack_check_pop_commit(stack);
+	if (error != STACK_OK)
+		return error;
+
+	stack_remove_elements(stack, 1);
+
+	return STACK_OK;
+}
+
+
+stack_error_t stack_pop_finish_ (stack_t *stack, uint64_t slot_hash)
+{
+	stack_error_t error = stack_check_pop_commit(stack);
+	if (error != STACK_OK)
+		return error;
+
+	stack_fold_data_hash(stack, slot_hash);
+	stack_drop_elements(stack, 1);
+
+	return STACK_OK;
+}
+
+
+void *stack_emplace_begin (stack_t *stack, stack_error_t *error)
+{
+	stack_error_t result = STACK_OK;
+
+	#if VALIDATION == ON
+
+		if_log (is_bad_ptr(stack), ERROR)
+			result = INVALID_PTR;
+		else
+			result = stack_validate(stack);
+
+		if_log (result == STACK_OK &&
+				(stack->state & STATE_EMPLACING_), ERROR)
+			result = EMPLACE_ERROR;
+
+	#endif
+
+	if_log (result == STACK_OK && stack->frozen, ERROR)
+		result = STACK_FROZEN;
+
+	if (result == STACK_OK)
+	{
+		size_t new_capacity = increase_capacity(stack, stack->size + 1);
+
+		if (new_capacity != stack->capacity &&
+		    stack_change_capacity(stack, new_capacity) != STACK_OK)
+			result = ALLOCATION_ERROR;
+	}
+
+	if (error)
+		*error = result;
+
+	if (result != STACK_OK)
+		return NULL;
+
+	stack->state |= STATE_EMPLACING_;
+	stack_calculate_hash(stack);
+
+	return stack_element_ptr(stack, stack->size);
+}
+
+
+stack_error_t stack_emplace_commit (stack_t *stack)
+{
+	#if VALIDATION == ON
+
+		if_log (is_bad_ptr(stack), ERROR)
+			return INVALID_PTR;
+
+		stack_error_t error = stack_validate(stack);
+		if (error != STACK_OK)
+			return error;
+
+		if_log (!(stack->state & STATE_EMPLACING_), ERROR)
+			return EMPLACE_ERROR;
+
+	#endif
+
+	stack->state &= ~STATE_EMPLACING_;
+	stack->size++;
+
+	stack_update_data_hash(stack, stack->size - 1);
+	stack_recalculate_data_hash(stack);
+	stack_calculate_hash(stack);
+
+	return STACK_OK;
+}
+
+
+stack_error_t stack_emplace_cancel (stack_t *stack)
+{
+	#if VALIDATION == ON
+
+		if_log (is_bad_ptr(stack), ERROR)
 			return INVALID_PTR;
-		if_log (is_bad_ptr(result), ERROR)
+
+		if_log (!(stack->state & STATE_EMPLACING_), ERROR)
+			return EMPLACE_ERROR;
+
+	#endif
+
+	poison_fill(stack_element_ptr(stack, stack->size), POISON,
+	            stack->element_size);
+
+	if (stack->dirty_top <= stack->size)
+		stack->dirty_top = stack->size + 1;
+
+	stack->state &= ~STATE_EMPLACING_;
+	stack_calculate_hash(stack);
+
+	#if VALIDATION == ON
+		return stack_validate(stack);
+	#else
+		return STACK_OK;
+	#endif
+}
+
+
+stack_error_t stack_reserve (stack_t *stack, size_t capacity)
+{
+	#if VALIDATION == ON
+
+		if_log (is_bad_ptr(stack), ERROR)
 			return INVALID_PTR;
 
-		stack_error_t error = stack_check(stack);
-		if ( error != STACK_OK )
+		stack_error_t error = stack_validate(stack);
+		if (error != STACK_OK)
 			return error;
 
 	#endif
 
-	if (!stack_size(stack))
-		return STACK_EMPTY;
+	if_log (stack->frozen, ERROR)
+		return STACK_FROZEN;
+
+	if (capacity <= stack->capacity)
+		return STACK_OK;
+
+	if (capacity > SIZE_MAX / stack->element_size)
+		return ALLOCATION_ERROR;
+
+	if (stack_change_capacity(stack, capacity) != STACK_OK)
+		return ALLOCATION_ERROR;
 
-	void *last_element = stack_last_element_ptr(stack);
-	memcpy(result, last_element, stack->element_size);
+	stack_calculate_hash(stack);
 
 	return STACK_OK;
 }
 
 
-stack_error_t stack_pop (stack_t *stack, void *result)
+stack_error_t stack_set_growth_policy (stack_t *stack, growth_policy_t policy,
+		size_t step)
 {
 	#if VALIDATION == ON
 
 		if_log (is_bad_ptr(stack), ERROR)
 			return INVALID_PTR;
-		if_log (is_bad_ptr(result), ERROR)
+
+		stack_error_t error = stack_validate(stack);
+		if (error != STACK_OK)
+			return error;
+
+		if_log (policy >= GROWTH_CUSTOM, ERROR)
+			return SOME_ERROR;
+		if_log (policy == GROWTH_FIXED_STEP && step == 0, ERROR)
+			return SOME_ERROR;
+
+	#endif
+
+	if_log (stack->frozen, ERROR)
+		return STACK_FROZEN;
+
+	stack->growth_policy = policy;
+	stack->growth_step   = step;
+	stack->capacity_func = NULL;
+
+	stack_calculate_hash(stack);
+
+	return STACK_OK;
+}
+
+
+stack_error_t stack_set_capacity_func (stack_t *stack, capacity_func_t func)
+{
+	#if VALIDATION == ON
+
+		if_log (is_bad_ptr(stack), ERROR)
 			return INVALID_PTR;
 
+		stack_error_t error = stack_validate(stack);
+		if (error != STACK_OK)
+			return error;
+
+		if_log (!func, ERROR)
+			return SOME_ERROR;
+
 	#endif
 
-	stack_error_t error = stack_top(stack, result);
+	if_log (stack->frozen, ERROR)
+		return STACK_FROZEN;
 
-	if (error != STACK_OK)
-		return error;
-	
-	void *last_element = stack_last_element_ptr(stack);
-	memset(last_element, POISON, stack->element_size);
+	stack->growth_policy = GROWTH_CUSTOM;
+	stack->capacity_func = func;
+
+	stack_calculate_hash(stack);
+
+	return STACK_OK;
+}
+
+
+stack_error_t stack_set_low_water (stack_t *stack, size_t low_water)
+{
+	#if VALIDATION == ON
+
+		if_log (is_bad_ptr(stack), ERROR)
+			return INVALID_PTR;
+
+		stack_error_t error = stack_validate(stack);
+		if (error != STACK_OK)
+			return error;
+
+		if_log (low_water < MIN_LOW_WATER, ERROR)
+			return SOME_ERROR;
+
+	#endif
+
+	if_log (stack->frozen, ERROR)
+		return STACK_FROZEN;
+
+	stack->low_water = low_water;
+
+	stack_calculate_hash(stack);
+
+	return STACK_OK;
+}
+
+
+stack_error_t stack_set_options (stack_t *stack, unsigned options)
+{
+	#if VALIDATION == ON
+
+		if_log (is_bad_ptr(stack), ERROR)
+			return INVALID_PTR;
+
+		stack_error_t error = stack_validate(stack);
+		if (error != STACK_OK)
+			return error;
+
+		if_log (options & ~STACK_ALL_OPTIONS_, ERROR)
+			return SOME_ERROR;
+
+	#endif
+
+	if_log (stack->frozen, ERROR)
+		return STACK_FROZEN;
+
+	unsigned old_options = stack->options;
+	stack->options = options;
+
+	/* Data is moved to or from guard pages at once. */
+	if (((old_options ^ options) & STACK_GUARD_PAGES) &&
+	    stack->capacity > 0 &&
+	    stack_change_capacity(stack, stack->capacity) != STACK_OK)
+	{
+		stack->options = old_options;
+		return ALLOCATION_ERROR;
+	}
+
+	stack_calculate_hash(stack);
+
+	return STACK_OK;
+}
+
+
+stack_error_t stack_shrink_to_fit (stack_t *stack)
+{
+	#if VALIDATION == ON
+
+		if_log (is_bad_ptr(stack), ERROR)
+			return INVALID_PTR;
+
+		stack_error_t error = stack_validate(stack);
+		if (error != STACK_OK)
+			return error;
+
+	#endif
+
+	if_log (stack->frozen, ERROR)
+		return STACK_FROZEN;
+
+	if (stack->size == stack->capacity)
+		return STACK_OK;
 
-	stack->size--;
-	
-	size_t new_capacity =
-		reduce_capacity(stack->capacity, stack->size);
-	
 	if (stack->size == 0)
 	{
-		free(stack->data);
-		stack->data = POISON_PTR;
-		stack->capacity = 1;
+		stack_free_data(stack);
+		stack->data     = POISON_PTR;
+		stack->capacity = 0;
 	}
-	else if (stack->capacity != new_capacity
-	         && !stack_increase_capacity(stack, new_capacity))
+	else if (stack_change_capacity(stack, stack->size) != STACK_OK)
 		return ALLOCATION_ERROR;
 
 	stack_calculate_hash(stack);
@@ -475,47 +1796,113 @@ stack_error_t stack_pop (stack_t *stack, void *result)
 }
 
 
-stack_error_t stack_push (stack_t *stack, const void *pushed_value)
+stack_error_t stack_freeze (stack_t *stack)
 {
 	#if VALIDATION == ON
-	
+
 		if_log (is_bad_ptr(stack), ERROR)
 			return INVALID_PTR;
-		if_log (is_bad_ptr(pushed_value), WARNING)
-			return INVALID_PTR;
 
-		stack_error_t error = stack_check(stack);
+	#endif
 
+	if_log (stack->frozen, ERROR)
+		return STACK_FROZEN;
+
+	#if VALIDATION == ON
+
+		stack_error_t error = stack_check_full(stack);
 		if (error != STACK_OK)
 			return error;
 
-	#endif
+		if_log (stack->state & STATE_EMPLACING_, ERROR)
+			return EMPLACE_ERROR;
 
-	stack->size++;
+	#endif
 
-	void *last_element_ptr;
+	void *copy = mmap(NULL, page_size(), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (copy == MAP_FAILED)
+		return ALLOCATION_ERROR;
 
-	size_t new_capacity =
-		increase_capacity(stack->capacity, stack->size);
+	stack->frozen = copy;
 
-	if (new_capacity != stack->capacity)
+	/* Data allocated by malloc shares pages with other memory,
+	 * so it is moved to guard pages. */
+	if (stack->capacity > 0 &&
+	    !(stack->state & (STATE_MAPPED_ | STATE_GUARDED_)) &&
+	    stack_change_capacity(stack, stack->capacity) != STACK_OK)
 	{
-		if (!stack_increase_capacity(stack, new_capacity))
-			return ALLOCATION_ERROR;
+		stack_release_frozen(stack);
+		return ALLOCATION_ERROR;
+	}
 
-		last_element_ptr = stack_last_element_ptr(stack);
+	stack_calculate_hash(stack);
+	memcpy(copy, stack, sizeof *stack);
 
-		memset(last_element_ptr + stack->element_size, POISON,
-		       (new_capacity - stack->size) * stack->element_size);
-	}
-	else
+	if (mprotect(copy, page_size(), PROT_READ) != 0 ||
+	    stack_protect_data(stack, PROT_READ) != 0)
 	{
-		last_element_ptr = stack_last_element_ptr(stack);
+		stack_protect_data(stack, PROT_READ | PROT_WRITE);
+		stack_release_frozen(stack);
+		stack_calculate_hash(stack);
+		return ALLOCATION_ERROR;
 	}
-	memcpy(last_element_ptr, pushed_value, stack->element_size);
 
+	return STACK_OK;
+}
+
+
+stack_error_t stack_thaw (stack_t *stack)
+{
+	#if VALIDATION == ON
+
+		if_log (is_bad_ptr(stack), ERROR)
+			return INVALID_PTR;
+
+		stack_error_t error = stack_check(stack);
+		if (error != STACK_OK)
+			return error;
+
+	#endif
+
+	if (!stack->frozen)
+		return STACK_OK;
+
+	if (stack_protect_data(stack, PROT_READ | PROT_WRITE) != 0)
+		return ALLOCATION_ERROR;
+
+	stack_release_frozen(stack);
 	stack_calculate_hash(stack);
 
 	return STACK_OK;
 }
 
+
+stack_error_t stack_set_validation (stack_t *stack, validation_level_t level,
+		size_t check_period)
+{
+	#if VALIDATION == ON
+
+		if_log (is_bad_ptr(stack), ERROR)
+			return INVALID_PTR;
+
+		stack_error_t error = stack_check(stack);
+		if (error != STACK_OK)
+			return error;
+
+		if_log (level > VALIDATION_FULL, ERROR)
+			return SOME_ERROR;
+
+	#endif
+
+	if_log (stack->frozen, ERROR)
+		return STACK_FROZEN;
+
+	stack->validation_level = level;
+	stack->check_period     = check_period;
+	stack->check_counter    = 0;
+
+	stack_calculate_hash(stack);
+
+	return STACK_OK;
+}
@@ -21,16 +21,63 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 
-#if HASH == ON
-	#include <stdint.h>
-#endif
 
 
+/*========================= Types ========================*/
 
 
-/*========================= Types ========================*/
+/*! This enum describes how the stack capacity changes
+ *  when the stack grows or shrinks.
+ */
+typedef enum growth_policy_t_
+{
+	GROWTH_DOUBLE       = 0, /*!< capacity is multiplied by 2.             */
+	GROWTH_ONE_AND_HALF = 1, /*!< capacity is multiplied by 1.5.           */
+	GROWTH_FIXED_STEP   = 2, /*!< capacity changes by fixed step.          */
+	GROWTH_CUSTOM       = 3, /*!< capacity is calculated by user function. */
+} growth_policy_t;
+
+
+/*! This type describes user function which calculates stack capacity.
+ *  It is called when the stack grows and when it shrinks.
+ *
+ *  @param[in] capacity - current capacity of the stack.
+ *  @param[in] size     - new number of elements in the stack.
+ *
+ *  @return new capacity. It must be not less than size.
+ */
+typedef size_t (*capacity_func_t) (size_t capacity, size_t size);
+
+
+/*! This enum describes how deeply the stack is checked
+ *  before each operation.
+ */
+typedef enum validation_level_t_
+{
+	VALIDATION_NONE     = 0, /*!< the stack isn't checked.                   */
+	VALIDATION_HEADER   = 1, /*!< fields, canaries and hash of stack_t.      */
+	VALIDATION_CANARIES = 2, /*!< as above and canaries of stack data.       */
+	VALIDATION_FULL     = 3, /*!< as above, poison and hash of stack data.   */
+} validation_level_t;
+
+
+/*! This enum describes options which change the stack behaviour.
+ *  Options can be combined with operator |.
+ */
+typedef enum stack_option_t_
+{
+	STACK_NO_OPTIONS      = 0,      /*!< default behaviour.              */
+	STACK_RETAIN_CAPACITY = 1 << 0, /*!< pop never reduces the capacity. */
+	STACK_HUGE_PAGES      = 1 << 1, /*!< big data buffers are mapped with
+	                                     mmap and use huge pages.        */
+	STACK_GUARD_PAGES     = 1 << 2, /*!< data is mapped between PROT_NONE
+	                                     pages, so out-of-bounds access
+	                                     faults. Data has only the left
+	                                     canary. Overrides huge pages.   */
+} stack_option_t;
 
 
 /*! It is stack type.
@@ -43,7 +90,8 @@ typedef struct stack_t_
 	#endif
 
 	#if HASH == ON
-		uint64_t hash; /*!< hash value */
+		uint64_t hash;      /*!< hash value                     */
+		uint64_t data_hash; /*!< combined hash of stack elements */
 	#endif
 	
 	void *data;          /*!< pointer to stack data.                   */
@@ -52,6 +100,28 @@ typedef struct stack_t_
 	size_t capacity;     /*!< size of allocated memory for stack data. */
 	char   name[64];     /*!< name of stack_t variable.                */
 
+	growth_policy_t    growth_policy;    /*!< how capacity changes.        */
+	validation_level_t validation_level; /*!< check before operations.     */
+	size_t          growth_step;   /*!< step for GROWTH_FIXED_STEP.         */
+	capacity_func_t capacity_func; /*!< user function for GROWTH_CUSTOM.    */
+	size_t          low_water;     /*!< shrink if size <= capacity / it.    */
+	unsigned        options;       /*!< combination of stack_option_t.      */
+	unsigned        state;         /*!< internal state flags.               */
+	size_t          check_period;  /*!< full check every check_period-th
+	                                    operation, 0 - never.               */
+	size_t          check_counter; /*!< operations since last full check.   */
+	size_t          dirty_top;     /*!< memory of elements below it can be
+	                                    poisoned after the last check.      */
+
+	#if HASH == ON
+		size_t   verified_size; /*!< elements which aren't changed
+		                             after the last check.              */
+		uint64_t verified_hash; /*!< combined hash of these elements.   */
+	#endif
+
+	const struct stack_t_ *frozen; /*!< read-only copy of frozen stack,
+	                                    NULL if it isn't frozen.        */
+
 	#if CANARIES == ON
 		unsigned long long right_canary; /*!< right protective variable. */
 	#endif
@@ -71,6 +141,9 @@ typedef enum stack_error_t_
 	INVALID_PTR      = 3, /*!< pointer to stack is bad.                     */
 	INVALID_DATA_PTR = 4, /*!< ponter to stack data is bad.                 */
 	SOME_ERROR       = 5, /*!< some fields of the stack are corrupted.      */
+	EMPLACE_ERROR    = 6, /*!< emplace isn't started or isn't finished.     */
+	STACK_FULL       = 7, /*!< stack of fixed capacity has no free place.   */
+	STACK_FROZEN     = 8, /*!< frozen stack can't be changed.               */
 
 } stack_error_t;
 
@@ -94,6 +167,23 @@ typedef enum stack_error_t_
 stack_t *stack_create_func_ (const char *name, size_t size_element);
 
 
+/*! This function creates stack on heap and allocates memory
+ *  for capacity elements.
+ *
+ * @param[in] name         - name of stack variable.
+ * @param[in] size_element - size of one element in stack.
+ * @param[in] capacity     - number of elements for which memory is allocated.
+ *
+ * @return pointer to initialized stack_t value.
+ *
+ * @note Don't forget to free heap memory using stack_delete().
+ *
+ * @note Use stack_create_reserved() macro instead of this function.
+ */
+stack_t *stack_create_reserved_func_ (const char *name, size_t size_element,
+		size_t capacity);
+
+
 /*! This function initializes stack struct in correct way.
  *
  * @param[in] name         - name of the stack variable.
@@ -108,6 +198,23 @@ stack_t *stack_create_func_ (const char *name, size_t size_element);
 stack_t stack_constructor_func_ (const char *name, size_t size_element);
 
 
+/*! This function initializes stack struct in correct way
+ *  and allocates memory for capacity elements.
+ *
+ * @param[in] name         - name of the stack variable.
+ * @param[in] size_element - size of one element in stack.
+ * @param[in] capacity     - number of elements for which memory is allocated.
+ *
+ * @return initialized stack.
+ *
+ * @note Don't forget to free heap memory using stack_deconstructor()
+ *
+ * @note Use stack_constructor_reserved() macro instead of this function.
+ */
+stack_t stack_constructor_reserved_func_ (const char *name,
+		size_t size_element, size_t capacity);
+
+
 /*! This function frees heap memory that stack_t* value used.
  *
  *  @param[in,out] stack - pointer to the stack to be freed.
@@ -126,7 +233,12 @@ stack_error_t stack_delete (stack_t *stack);
 stack_error_t stack_deconstructor (stack_t *stack);
 
 
-/*! This function checks stack for integrity.
+/*! This function checks stack for integrity. Only elements and memory
+ *  which are changed after the previous successful check are verified,
+ *  so the check costs as much as the operations done since it.
+ *  Older elements are verified again only by stack_check_full()
+ *  and by the full check every check_period-th operation
+ *  (see stack_set_validation()).
  *
  * @param[in] stack           - stack to be checked.
  * @param[in] _CODE_POSITION_ - position in source code.
@@ -138,6 +250,19 @@ stack_error_t stack_deconstructor (stack_t *stack);
 stack_error_t stack_check_func_ (stack_t *stack, _CODE_POSITION_T_);
 
 
+/*! This function checks stack for integrity and verifies
+ *  all its memory, including elements verified by previous checks.
+ *
+ * @param[in] stack           - stack to be checked.
+ * @param[in] _CODE_POSITION_ - position in source code.
+ *
+ * @return stack_error
+ *
+ * @note Use stack_check_full() macro instead of this function.
+ */
+stack_error_t stack_check_full_func_ (stack_t *stack, _CODE_POSITION_T_);
+
+
 /*! This function returns the value from the top of the stack.
  *
  * @param[in] stack   - pointer to the stack.
@@ -168,10 +293,318 @@ stack_error_t stack_pop (stack_t *stack, void *result);
 stack_error_t stack_push (stack_t *stack, const void *pushed_value);
 
 
+/*! This function copies several values from the top of the stack.
+ *
+ * @param[in] stack   - pointer to the stack.
+ * @param[out] result - pointer to memory for count elements.
+ * @param[in] count   - number of elements.
+ *
+ * @return stack_error. STACK_EMPTY if the stack has less than count elements.
+ *
+ * @note Elements are written in the same order as they lie in the stack,
+ *       so the top of the stack is the last element of result.
+ */
+stack_error_t stack_peek_n (stack_t *stack, void *result, size_t count);
+
+
+/*! This function removes several values from the top of the stack
+ *  and copies them to result.
+ *
+ * @param[in] stack   - pointer to the stack.
+ * @param[out] result - pointer to memory for count elements.
+ * @param[in] count   - number of elements.
+ *
+ * @return stack_error. STACK_EMPTY if the stack has less than count elements.
+ *
+ * @note Elements are written in the same order as they lie in the stack,
+ *       so stack_push_n() of the result restores the stack.
+ */
+stack_error_t stack_pop_n (stack_t *stack, void *result, size_t count);
+
+
+/*! This function pushes an array of values to the stack.
+ *  The last element of the array becomes the top of the stack.
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *  @param[in] values    - pointer to the array of pushed values.
+ *  @param[in] count     - number of elements in the array.
+ *
+ *  @return stack_error
+ */
+stack_error_t stack_push_n (stack_t *stack, const void *values, size_t count);
+
+
+/*! This function returns pointer to the top element of the stack
+ *  without copying it.
+ *
+ * @param[in] stack  - pointer to the stack.
+ * @param[out] error - variable for stack_error. It can be NULL.
+ *
+ * @return pointer to the top element or NULL if an error occurred.
+ *
+ * @note The pointer becomes invalid after any change of the stack.
+ *       Don't write to the element: it breaks the stack hash.
+ */
+const void *stack_top_ptr (stack_t *stack, stack_error_t *error);
+
+
+/*! This function reserves place for a new element on the top
+ *  of the stack which is going to be added by stack_push_commit().
+ *
+ * @param[in,out] stack - pointer to the stack.
+ * @param[out] error    - variable for stack_error. It can be NULL.
+ *
+ * @return pointer to memory for the new element or NULL
+ *         if an error occurred.
+ *
+ * @note Unlike stack_emplace_begin() the stack isn't marked,
+ *       so write the element and call stack_push_commit() at once.
+ *       stack_push() is stack_push_begin(), copying
+ *       and stack_push_commit().
+ */
+void *stack_push_begin (stack_t *stack, stack_error_t *error);
+
+
+/*! This function adds the element written after stack_push_begin()
+ *  to the stack and updates its hash.
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *
+ *  @return stack_error
+ *
+ *  @note The stack isn't checked again, so call it right after
+ *        successful stack_push_begin().
+ */
+stack_error_t stack_push_commit (stack_t *stack);
+
+
+/*! This function returns pointer to the top element of the stack
+ *  which is going to be popped by stack_pop_commit().
+ *
+ * @param[in] stack  - pointer to the stack.
+ * @param[out] error - variable for stack_error. It can be NULL.
+ *
+ * @return pointer to the top element or NULL if an error occurred.
+ *
+ * @note The element must be copied before stack_pop_commit().
+ *       stack_pop() is stack_pop_begin(), copying and stack_pop_commit().
+ */
+const void *stack_pop_begin (stack_t *stack, stack_error_t *error);
+
+
+/*! This function removes the top element of the stack
+ *  after stack_pop_begin().
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *
+ *  @return stack_error
+ *
+ *  @note The stack isn't checked again, so call it right after
+ *        successful stack_pop_begin().
+ */
+stack_error_t stack_pop_commit (stack_t *stack);
+
+
+/*! This function is stack_push_commit() which takes the hash
+ *  of the new element instead of calculating it.
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *  @param[in] slot_hash - stack_slot_hash_mix_() of the element.
+ *
+ *  @return stack_error
+ *
+ *  @note It is used by functions from secure_stack_typed.h,
+ *        which hash elements of known size inline.
+ */
+stack_error_t stack_push_finish_ (stack_t *stack, uint64_t slot_hash);
+
+
+/*! This function is stack_pop_commit() for the top element
+ *  which is already poisoned.
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *  @param[in] slot_hash - stack_slot_hash_mix_() of the element
+ *                         before it was poisoned.
+ *
+ *  @return stack_error
+ *
+ *  @note It is used by functions from secure_stack_typed.h.
+ */
+stack_error_t stack_pop_finish_ (stack_t *stack, uint64_t slot_hash);
+
+
+/*! This function reserves place for a new element on the top of the stack
+ *  so that the element can be constructed in place.
+ *
+ * @param[in,out] stack - pointer to the stack.
+ * @param[out] error    - variable for stack_error. It can be NULL.
+ *
+ * @return pointer to memory for the new element or NULL
+ *         if an error occurred.
+ *
+ * @note The element is added only by stack_emplace_commit().
+ *       Don't call other stack functions before it
+ *       or stack_emplace_cancel().
+ */
+void *stack_emplace_begin (stack_t *stack, stack_error_t *error);
+
+
+/*! This function adds the element constructed after stack_emplace_begin()
+ *  to the stack and updates its hash.
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *
+ *  @return stack_error
+ */
+stack_error_t stack_emplace_commit (stack_t *stack);
+
+
+/*! This function discards the element started by stack_emplace_begin().
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *
+ *  @return stack_error
+ */
+stack_error_t stack_emplace_cancel (stack_t *stack);
+
+
+/*! This function sets the way the stack capacity changes.
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *  @param[in] policy    - GROWTH_DOUBLE, GROWTH_ONE_AND_HALF
+ *                         or GROWTH_FIXED_STEP.
+ *  @param[in] step      - number of elements by which capacity changes
+ *                         if policy is GROWTH_FIXED_STEP.
+ *
+ *  @return stack_error
+ *
+ *  @note Capacity is reduced only when the stack is much smaller than it,
+ *        so alternating push and pop don't reallocate memory.
+ */
+stack_error_t stack_set_growth_policy (stack_t *stack, growth_policy_t policy,
+		size_t step);
+
+
+/*! This function sets user function which calculates the stack capacity
+ *  and switches the stack to GROWTH_CUSTOM policy.
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *  @param[in] func      - function which calculates new capacity.
+ *
+ *  @return stack_error
+ */
+stack_error_t stack_set_capacity_func (stack_t *stack, capacity_func_t func);
+
+
+/*! This function sets low-water mark of the stack:
+ *  pop reduces capacity only if size <= capacity / low_water.
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *  @param[in] low_water - low-water mark. It must be at least 3.
+ *
+ *  @return stack_error
+ *
+ *  @note It isn't used by GROWTH_CUSTOM policy.
+ */
+stack_error_t stack_set_low_water (stack_t *stack, size_t low_water);
+
+
+/*! This function sets options of the stack.
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *  @param[in] options   - combination of stack_option_t values.
+ *
+ *  @return stack_error
+ */
+stack_error_t stack_set_options (stack_t *stack, unsigned options);
+
+
+/*! This function reduces the stack capacity to its size.
+ *  Memory of the empty stack is freed.
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *
+ *  @return stack_error
+ *
+ *  @note pop doesn't free memory when the stack becomes empty,
+ *        so use this function to release it.
+ */
+stack_error_t stack_shrink_to_fit (stack_t *stack);
+
+
+/*! This function allocates memory for at least capacity elements,
+ *  so pushing up to capacity elements doesn't reallocate memory.
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *  @param[in] capacity  - number of elements.
+ *
+ *  @return stack_error
+ *
+ *  @note pop can reduce the capacity again. Set STACK_RETAIN_CAPACITY
+ *        option to prevent it.
+ */
+stack_error_t stack_reserve (stack_t *stack, size_t capacity);
+
+
+/*! This function checks the stack fully and makes it read-only.
+ *  Pages with stack data are protected with mprotect, data allocated
+ *  by malloc is moved to mapped memory before it. A copy of stack_t
+ *  is kept in a read-only page.
+ *
+ *  Functions which change the frozen stack return STACK_FROZEN.
+ *  Checks of the frozen stack only compare stack_t with the copy,
+ *  because its data can't be changed.
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *
+ *  @return stack_error
+ *
+ *  @note stack_delete() can delete the frozen stack.
+ */
+stack_error_t stack_freeze (stack_t *stack);
+
+
+/*! This function makes the frozen stack writable again.
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *
+ *  @return stack_error
+ */
+stack_error_t stack_thaw (stack_t *stack);
+
+
+/*! This function sets how deeply the stack is checked before operations.
+ *
+ *  @param[in,out] stack    - pointer to the stack.
+ *  @param[in] level        - validation level of ordinary operations.
+ *  @param[in] check_period - every check_period-th operation checks
+ *                            the stack like stack_check_full().
+ *                            0 disables it.
+ *
+ *  @return stack_error
+ *
+ *  @note It works only if VALIDATION is ON. stack_check() always
+ *        checks the stack at VALIDATION_FULL level.
+ */
+stack_error_t stack_set_validation (stack_t *stack, validation_level_t level,
+		size_t check_period);
+
+
 
 
 /*================== Functional macros ===================*/
 
+/*! This macro returns the hash of the element in the data hash
+ *  of the stack. The same elements at different indexes have
+ *  different hashes.
+ *
+ * @param[in] ELEMENT_HASH_ - HASH_FUNCTION of the element.
+ * @param[in] INDEX_        - index of the element.
+ */
+#define stack_slot_hash_mix_(ELEMENT_HASH_, INDEX_) \
+	hash64_mix((ELEMENT_HASH_) + ((INDEX_) + 1) * 0x9E3779B97F4A7C15ULL)
+
+
 /*! This macro initializes stack struct in correct way.
  *
  */
@@ -186,6 +619,24 @@ stack_error_t stack_push (stack_t *stack, const void *pushed_value);
 	stack_t *NAME_ = stack_create_func_(#NAME_, sizeof(TYPE_))
 
 
+/*! This macro initializes stack struct in correct way
+ *  and allocates memory for CAPACITY_ elements.
+ *
+ */
+#define stack_constructor_reserved(NAME_, TYPE_, CAPACITY_) \
+	stack_t NAME_ = stack_constructor_reserved_func_(#NAME_, sizeof(TYPE_),\
+	                                                 CAPACITY_)
+
+
+/*! This macro creates stack on heap
+ *  and allocates memory for CAPACITY_ elements.
+ *
+ */
+#define stack_create_reserved(NAME_, TYPE_, CAPACITY_) \
+	stack_t *NAME_ = stack_create_reserved_func_(#NAME_, sizeof(TYPE_),\
+	                                             CAPACITY_)
+
+
 /*! This macro returns the size of one element in the stack.
  *
  * @param[in] STACK_ - pointer to the stack.
@@ -226,6 +677,25 @@ stack_error_t stack_push (stack_t *stack, const void *pushed_value);
 		                        stack_size(STACK_))
 
 
+/*! This macro returns the number of elements for which
+ *  the stack has allocated memory.
+ *
+ * @param[in] STACK_ - pointer to the stack.
+ *
+ * @return capacity of the stack.
+ */
+#define stack_capacity(STACK_) (STACK_)->capacity
+
+
+/*! This macro returns options of the stack.
+ *
+ * @param[in] STACK_ - pointer to the stack.
+ *
+ * @return combination of stack_option_t values.
+ */
+#define stack_options(STACK_) (STACK_)->options
+
+
 /*! This macro checks stack for integrity.
  *
  * @param[in] stack - stack to be checked.
@@ -237,6 +707,16 @@ stack_error_t stack_push (stack_t *stack, const void *pushed_value);
 #define stack_check(STACK_) stack_check_func_(STACK_, _CURRENT_CODE_POSITION_)
 
 
+/*! This macro checks all memory of the stack for integrity.
+ *
+ * @param[in] STACK_ - stack to be checked.
+ *
+ * @return stack_error
+ */
+#define stack_check_full(STACK_) \
+	stack_check_full_func_(STACK_, _CURRENT_CODE_POSITION_)
+
+
 #if HASH == ON
 
 /*! This macro gets hash from tha stack.
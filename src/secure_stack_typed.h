@@ -0,0 +1,191 @@
+/*!
+ * @file
+ * This header file contains a generator of typed functions
+ * for stacks of one element type.
+ *
+ * DECLARE_SECURE_STACK(int_stack, int) declares
+ *   stack_t      *int_stack_create (const char *name);
+ *   stack_error_t int_stack_push   (stack_t *stack, int value);
+ *   stack_error_t int_stack_pop    (stack_t *stack, int *result);
+ *   stack_error_t int_stack_top    (stack_t *stack, int *result);
+ *
+ * Elements are copied by assignment of TYPE_ instead of memcpy
+ * of element_size bytes. The pushed or popped element is hashed
+ * and poisoned by inline functions with sizeof(TYPE_) known at
+ * compile time, so the compiler unrolls them for small types.
+ * The stack is checked and its header is hashed by the same
+ * functions as in stack_push() and stack_pop().
+ */
+
+
+
+
+#ifndef STACK_TYPED_H_
+#define STACK_TYPED_H_
+
+
+
+
+/*================= Connecting headers ==================*/
+
+
+#include "secure_stack.h"
+#include "others.h"
+
+#if HASH == ON
+	#include "hash.h"
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+
+
+
+/*=================== Inline functions ===================*/
+
+
+#if HASH == ON && INCREMENTAL_HASH == ON
+
+/* HASH_FUNCTION with _inline suffix from hash.h. */
+#define stack_inline_hash_(DATA_, LEN_) \
+	stack_inline_hash_name_(HASH_FUNCTION)(DATA_, LEN_)
+#define stack_inline_hash_name_(FUNC_) stack_inline_hash_paste_(FUNC_)
+#define stack_inline_hash_paste_(FUNC_) FUNC_##_inline
+
+#endif
+
+
+/*! This function returns the hash of the element for the data hash.
+ *  It is 0 if the data hash isn't updated by push and pop.
+ */
+static inline __attribute__((always_inline))
+uint64_t stack_typed_slot_hash_ (const void *slot, size_t index,
+		size_t element_size)
+{
+	#if HASH == ON && INCREMENTAL_HASH == ON
+		return stack_slot_hash_mix_(stack_inline_hash_(slot, element_size),
+				index);
+	#else
+		(void) slot;
+		(void) index;
+		(void) element_size;
+		return 0;
+	#endif
+}
+
+
+/*! This function is stack_push_commit() for the element
+ *  of element_size bytes written to slot after stack_push_begin().
+ */
+static inline __attribute__((always_inline))
+stack_error_t stack_push_commit_sized_ (stack_t *stack, const void *slot,
+		size_t element_size)
+{
+	return stack_push_finish_(stack,
+			stack_typed_slot_hash_(slot, stack->size, element_size));
+}
+
+
+/*! This function is stack_pop_commit() for the top element
+ *  of element_size bytes returned by stack_pop_begin().
+ *
+ *  @note stack_pop_begin() has checked that the stack isn't empty,
+ *        frozen or emplacing, so the element can be poisoned.
+ */
+static inline __attribute__((always_inline))
+stack_error_t stack_pop_commit_sized_ (stack_t *stack, const void *top,
+		size_t element_size)
+{
+	uint64_t slot_hash = stack_typed_slot_hash_(top, stack->size - 1,
+			element_size);
+	memset((void *) top, POISON, element_size);
+
+	return stack_pop_finish_(stack, slot_hash);
+}
+
+
+
+
+/*================== Functional macros ===================*/
+
+
+#if VALIDATION == ON
+
+/*! This macro is if which is true and writes the log if the stack
+ *  isn't a stack of TYPE_. It is used before the stack is changed,
+ *  bad pointer to the stack is reported by the function called after it.
+ */
+#define if_stack_type_mismatch_(STACK_, TYPE_) \
+	if_log (!is_bad_ptr(STACK_) && (STACK_)->element_size != sizeof(TYPE_),\
+			ERROR)
+
+#else
+
+#define if_stack_type_mismatch_(STACK_, TYPE_) if (false)
+
+#endif
+
+
+/*! This macro declares typed functions for stacks of TYPE_.
+ *
+ * @param[in] NAME_ - prefix of function names.
+ * @param[in] TYPE_ - type of elements. Its alignment must be
+ *                    not more than 8 bytes.
+ */
+#define DECLARE_SECURE_STACK(NAME_, TYPE_) \
+\
+_Static_assert(_Alignof(TYPE_) <= sizeof(uint64_t),\
+		"Elements of the stack are aligned only to 8 bytes");\
+\
+static inline stack_t *NAME_##_create (const char *name)\
+{\
+	return stack_create_func_(name, sizeof(TYPE_));\
+}\
+\
+static inline stack_error_t NAME_##_push (stack_t *stack, TYPE_ value)\
+{\
+	if_stack_type_mismatch_(stack, TYPE_)\
+		return SOME_ERROR;\
+\
+	stack_error_t error = STACK_OK;\
+	TYPE_ *slot = (TYPE_ *) stack_push_begin(stack, &error);\
+	if (!slot)\
+		return error;\
+\
+	*slot = value;\
+	return stack_push_commit_sized_(stack, slot, sizeof(TYPE_));\
+}\
+\
+static inline stack_error_t NAME_##_pop (stack_t *stack, TYPE_ *result)\
+{\
+	if_stack_type_mismatch_(stack, TYPE_)\
+		return SOME_ERROR;\
+\
+	stack_error_t error = STACK_OK;\
+	const TYPE_ *top = (const TYPE_ *) stack_pop_begin(stack, &error);\
+	if (!top)\
+		return error;\
+\
+	*result = *top;\
+	return stack_pop_commit_sized_(stack, top, sizeof(TYPE_));\
+}\
+\
+static inline stack_error_t NAME_##_top (stack_t *stack, TYPE_ *result)\
+{\
+	if_stack_type_mismatch_(stack, TYPE_)\
+		return SOME_ERROR;\
+\
+	stack_error_t error = STACK_OK;\
+	const TYPE_ *top = (const TYPE_ *) stack_top_ptr(stack, &error);\
+	if (!top)\
+		return error;\
+\
+	*result = *top;\
+	return STACK_OK;\
+}\
+\
+typedef TYPE_ NAME_##_element_t
+
+
+#endif
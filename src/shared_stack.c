@@ -0,0 +1,578 @@
+/*!
+ * @file
+ * @brief A source code of functions for working with the shared stack.
+ */
+
+
+
+
+/*================= Connecting headers ==================*/
+
+
+#include "shared_stack.h"
+#include "others.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+
+/*================== Local functions =====================*/
+
+
+static void lock (pthread_mutex_t *mutex)
+{
+	pthread_mutex_lock(mutex);
+}
+
+
+static void unlock (pthread_mutex_t *mutex)
+{
+	pthread_mutex_unlock(mutex);
+}
+
+
+#if VALIDATION == ON
+
+static stack_error_t validate_header (shared_stack_t *stack)
+{
+	if_log (is_bad_ptr(stack), ERROR)
+		return INVALID_PTR;
+
+	#if CANARIES == ON
+
+		if_log (stack->left_canary != CANARY ||
+		        stack->right_canary != CANARY, ERROR)
+			return SOME_ERROR;
+
+	#endif
+
+	if_log (stack->batch == 0 || stack->local_capacity < stack->batch ||
+	        stack->max_workers == 0, ERROR)
+		return SOME_ERROR;
+
+	if_log (is_bad_mem(stack->locals,
+			stack->max_workers * sizeof *stack->locals), ERROR)
+		return INVALID_DATA_PTR;
+
+	return STACK_OK;
+}
+
+
+/* Checks that the local belongs to the shared stack. */
+static stack_error_t validate_local (shared_stack_local_t *local)
+{
+	if_log (is_bad_ptr(local), ERROR)
+		return INVALID_PTR;
+
+	stack_error_t error = validate_header(local->owner);
+	if (error != STACK_OK)
+		return error;
+
+	if_log (local->index >= local->owner->max_workers ||
+	        &local->owner->locals[local->index] != local, ERROR)
+		return SOME_ERROR;
+
+	if_log (!local->attached, ERROR)
+		return SOME_ERROR;
+
+	return STACK_OK;
+}
+
+#endif
+
+
+/* Moves count elements from the top of source to destination
+ * through the buffer. Memory of destination is reserved before
+ * the elements are popped, and they are returned to source
+ * if destination still can't take them, so no element is lost. */
+static stack_error_t move_elements (stack_t *source, stack_t *destination,
+		void *buffer, size_t count)
+{
+	stack_error_t error = stack_reserve(destination,
+			stack_size(destination) + count);
+	if (error != STACK_OK)
+		return error;
+
+	error = stack_pop_n(source, buffer, count);
+	if (error != STACK_OK)
+		return error;
+
+	error = stack_push_n(destination, buffer, count);
+	if (error != STACK_OK)
+		stack_push_n(source, buffer, count);
+
+	return error;
+}
+
+
+/* Moves count elements from the top of the local stack
+ * to the common stack. The local must be locked. */
+static stack_error_t spill (shared_stack_local_t *local, size_t count)
+{
+	shared_stack_t *stack = local->owner;
+
+	lock(&stack->lock);
+	stack_error_t error = move_elements(&local->stack, &stack->common,
+			local->buffer, count);
+	unlock(&stack->lock);
+
+	return error;
+}
+
+
+/* Moves up to a batch of elements from the common stack
+ * to the local stack. The local must be locked. */
+static stack_error_t refill (shared_stack_local_t *local)
+{
+	shared_stack_t *stack = local->owner;
+
+	lock(&stack->lock);
+
+	size_t count = stack_size(&stack->common);
+	if (count > stack->batch)
+		count = stack->batch;
+
+	stack_error_t error = count > 0 ?
+			move_elements(&stack->common, &local->stack, local->buffer,
+					count) : STACK_EMPTY;
+
+	unlock(&stack->lock);
+
+	return error;
+}
+
+
+/* Moves up to half of the elements of the victim (but not more than
+ * a batch) to the thief, the top of them is written to result.
+ * The thief must be locked. Returns STACK_EMPTY if the victim
+ * is busy or empty. */
+static stack_error_t steal_from (shared_stack_local_t *thief,
+		shared_stack_local_t *victim, void *result)
+{
+	if (pthread_mutex_trylock(&victim->lock) != 0)
+		return STACK_EMPTY;
+
+	size_t count = (stack_size(&victim->stack) + 1) / 2;
+	if (count > thief->owner->batch)
+		count = thief->owner->batch;
+
+	stack_error_t error = count > 0 ?
+			move_elements(&victim->stack, &thief->stack, thief->buffer,
+					count) : STACK_EMPTY;
+
+	unlock(&victim->lock);
+
+	if (error == STACK_OK)
+		error = stack_pop(&thief->stack, result);
+
+	return error;
+}
+
+
+static stack_error_t init_local (shared_stack_t *stack, size_t index)
+{
+	shared_stack_local_t *local = &stack->locals[index];
+	char name[128];
+
+	snprintf(name, sizeof name, "%s.locals[%zu]", stack->name, index);
+	local->stack = stack_constructor_func_(name, stack->element_size);
+	local->index = index;
+	local->owner = stack;
+
+	pthread_mutex_init(&local->lock, NULL);
+	stack_set_options(&local->stack, STACK_RETAIN_CAPACITY);
+
+	local->buffer = malloc(stack->batch * stack->element_size);
+	if (!local->buffer)
+		return ALLOCATION_ERROR;
+
+	return STACK_OK;
+}
+
+
+static void destroy_local (shared_stack_local_t *local)
+{
+	stack_deconstructor(&local->stack);
+	pthread_mutex_destroy(&local->lock);
+	free(local->buffer);
+}
+
+
+
+
+/*=================== Global functions ===================*/
+
+
+shared_stack_t *shared_stack_create_func_ (const char *name,
+		size_t element_size, size_t max_workers)
+{
+	#if VALIDATION == ON
+
+	if_log (element_size <= 0, ERROR)
+		return NULL;
+
+	if_log (max_workers == 0, ERROR)
+		return NULL;
+
+	if_log (is_bad_ptr(name), ERROR)
+		name = "UNKNOWN";
+
+	#endif
+
+	shared_stack_t *stack = (shared_stack_t *) aligned_alloc(
+			_Alignof(shared_stack_t), sizeof *stack);
+	if (!stack)
+		return NULL;
+
+	memset(stack, 0, sizeof *stack);
+	strncpy(stack->name, name, sizeof stack->name - 1);
+
+	stack->element_size   = element_size;
+	stack->max_workers    = max_workers;
+	stack->batch          = DEFAULT_SHARED_BATCH;
+	stack->local_capacity = DEFAULT_SHARED_LOCAL_CAPACITY;
+	stack->common         = stack_constructor_func_(name, element_size);
+	stack->free_local     = max_workers;
+	pthread_mutex_init(&stack->lock, NULL);
+	atomic_init(&stack->workers, 0);
+
+	#if CANARIES == ON
+		stack->left_canary = stack->right_canary = CANARY;
+	#endif
+
+	stack->locals = (shared_stack_local_t *) aligned_alloc(
+			_Alignof(shared_stack_local_t),
+			max_workers * sizeof *stack->locals);
+	if (!stack->locals)
+	{
+		shared_stack_delete(stack);
+		return NULL;
+	}
+
+	memset(stack->locals, 0, max_workers * sizeof *stack->locals);
+
+	for (size_t i = 0; i < max_workers; ++i)
+	{
+		if (init_local(stack, i) != STACK_OK)
+		{
+			stack->max_workers = i + 1;
+			shared_stack_delete(stack);
+			return NULL;
+		}
+	}
+
+	return stack;
+}
+
+
+stack_error_t shared_stack_delete (shared_stack_t *stack)
+{
+	if (!stack)
+		return STACK_OK;
+
+	stack_error_t error = STACK_OK;
+
+	#if VALIDATION == ON
+
+	if_log (is_bad_ptr(stack), ERROR)
+		return INVALID_PTR;
+
+	#endif
+
+	if (stack->locals)
+	{
+		for (size_t i = 0; i < stack->max_workers; ++i)
+			destroy_local(&stack->locals[i]);
+
+		mem_cache_invalidate(stack->locals,
+				stack->max_workers * sizeof *stack->locals);
+		free(stack->locals);
+	}
+
+	error = stack_deconstructor(&stack->common);
+	pthread_mutex_destroy(&stack->lock);
+
+	mem_cache_invalidate(stack, sizeof *stack);
+	free(stack);
+
+	return error;
+}
+
+
+stack_error_t shared_stack_check_func_ (shared_stack_t *stack,
+		_CODE_POSITION_T_)
+{
+	if (is_bad_ptr(stack))
+	{
+		char str[100];
+		sprintf(str, "shared_stack_t *unknown = %p", (void *) stack);
+		write_log_at("Pointer to stack is bad!", str, ERROR, 0,
+				_CODE_POSITION_);
+		return INVALID_PTR;
+	}
+
+	#if CANARIES == ON
+
+		if (stack->left_canary != CANARY || stack->right_canary != CANARY)
+		{
+			char str[300];
+			sprintf(str, "%s->left_canary = %llx, %s->right_canary = %llx, "
+					"CANARY = %lx", stack->name, stack->left_canary,
+					stack->name, stack->right_canary, CANARY);
+			write_log_at("Canaries incorrect!", str, ERROR, 0,
+					_CODE_POSITION_);
+			return SOME_ERROR;
+		}
+
+	#endif
+
+	if (stack->batch == 0 || stack->local_capacity < stack->batch ||
+	    stack->max_workers == 0 || is_bad_mem(stack->locals,
+			stack->max_workers * sizeof *stack->locals))
+	{
+		char str[300];
+		sprintf(str, "%s->batch = %zu, %s->local_capacity = %zu, "
+				"%s->locals = %p", stack->name, stack->batch, stack->name,
+				stack->local_capacity, stack->name, (void *) stack->locals);
+		write_log_at("Fields of stack incorrect!", str, ERROR, 0,
+				_CODE_POSITION_);
+		return SOME_ERROR;
+	}
+
+	lock(&stack->lock);
+	stack_error_t error = stack_check_func_(&stack->common, _CODE_POSITION_);
+	unlock(&stack->lock);
+
+	for (size_t i = 0; i < stack->max_workers && error == STACK_OK; ++i)
+	{
+		shared_stack_local_t *local = &stack->locals[i];
+
+		lock(&local->lock);
+		error = stack_check_func_(&local->stack, _CODE_POSITION_);
+		unlock(&local->lock);
+	}
+
+	return error;
+}
+
+
+stack_error_t shared_stack_set_batch (shared_stack_t *stack, size_t batch,
+		size_t local_capacity)
+{
+	#if VALIDATION == ON
+
+		stack_error_t valid = validate_header(stack);
+		if (valid != STACK_OK)
+			return valid;
+
+		if_log (batch == 0 || local_capacity < batch, ERROR)
+			return SOME_ERROR;
+
+	#endif
+
+	for (size_t i = 0; i < stack->max_workers; ++i)
+	{
+		shared_stack_local_t *local = &stack->locals[i];
+
+		void *buffer = realloc(local->buffer, batch * stack->element_size);
+		if (!buffer)
+			return ALLOCATION_ERROR;
+
+		local->buffer = buffer;
+	}
+
+	stack->batch          = batch;
+	stack->local_capacity = local_capacity;
+
+	return STACK_OK;
+}
+
+
+shared_stack_local_t *shared_stack_attach (shared_stack_t *stack)
+{
+	#if VALIDATION == ON
+
+		if (validate_header(stack) != STACK_OK)
+			return NULL;
+
+	#endif
+
+	lock(&stack->lock);
+
+	size_t index = stack->free_local;
+	if (index < stack->max_workers)
+		stack->free_local = stack->locals[index].next_free;
+	else
+	{
+		/* Thieves read workers without the lock. */
+		index = atomic_load(&stack->workers);
+		if (index < stack->max_workers)
+			atomic_store(&stack->workers, index + 1);
+	}
+
+	if (index < stack->max_workers)
+		stack->locals[index].attached = true;
+
+	unlock(&stack->lock);
+
+	if_log (index >= stack->max_workers, ERROR)
+		return NULL;
+
+	return &stack->locals[index];
+}
+
+
+stack_error_t shared_stack_detach (shared_stack_local_t *local)
+{
+	stack_error_t error = shared_stack_flush(local);
+	if (error != STACK_OK)
+		return error;
+
+	shared_stack_t *stack = local->owner;
+
+	lock(&stack->lock);
+	local->attached   = false;
+	local->next_free  = stack->free_local;
+	stack->free_local = local->index;
+	unlock(&stack->lock);
+
+	return STACK_OK;
+}
+
+
+stack_error_t shared_stack_flush (shared_stack_local_t *local)
+{
+	#if VALIDATION == ON
+
+		stack_error_t valid = validate_local(local);
+		if (valid != STACK_OK)
+			return valid;
+
+	#endif
+
+	stack_error_t error = STACK_OK;
+	lock(&local->lock);
+
+	while (error == STACK_OK && stack_size(&local->stack) > 0)
+	{
+		size_t count = stack_size(&local->stack);
+		if (count > local->owner->batch)
+			count = local->owner->batch;
+
+		error = spill(local, count);
+	}
+
+	unlock(&local->lock);
+	return error;
+}
+
+
+stack_error_t shared_stack_push (shared_stack_local_t *local,
+		const void *pushed_value)
+{
+	#if VALIDATION == ON
+
+		stack_error_t valid = validate_local(local);
+		if (valid != STACK_OK)
+			return valid;
+
+	#endif
+
+	stack_error_t error = STACK_OK;
+	lock(&local->lock);
+
+	if (stack_size(&local->stack) >= local->owner->local_capacity)
+		error = spill(local, local->owner->batch);
+
+	if (error == STACK_OK)
+		error = stack_push(&local->stack, pushed_value);
+
+	unlock(&local->lock);
+	return error;
+}
+
+
+stack_error_t shared_stack_pop (shared_stack_local_t *local, void *result)
+{
+	#if VALIDATION == ON
+
+		stack_error_t valid = validate_local(local);
+		if (valid != STACK_OK)
+			return valid;
+
+	#endif
+
+	stack_error_t error = STACK_OK;
+	lock(&local->lock);
+
+	if (stack_size(&local->stack) == 0)
+		error = refill(local);
+
+	if (error == STACK_OK)
+		error = stack_pop(&local->stack, result);
+
+	unlock(&local->lock);
+	return error;
+}
+
+
+stack_error_t shared_stack_steal (shared_stack_local_t *local, void *result)
+{
+	#if VALIDATION == ON
+
+		stack_error_t valid = validate_local(local);
+		if (valid != STACK_OK)
+			return valid;
+
+		if_log (is_bad_mem(result, local->owner->element_size), ERROR)
+			return INVALID_PTR;
+
+	#endif
+
+	shared_stack_t *stack = local->owner;
+	size_t workers = atomic_load(&stack->workers);
+	if (workers > stack->max_workers)
+		workers = stack->max_workers;
+
+	/* Victims are visited starting from the next worker,
+	 * so thieves don't attack the same one. The victim is only
+	 * tried while the thief is locked, so they can't deadlock. */
+	stack_error_t error = STACK_EMPTY;
+	lock(&local->lock);
+
+	for (size_t i = 1; i < workers && error == STACK_EMPTY; ++i)
+		error = steal_from(local,
+				&stack->locals[(local->index + i) % workers], result);
+
+	unlock(&local->lock);
+	return error;
+}
+
+
+size_t shared_stack_size (shared_stack_t *stack)
+{
+	#if VALIDATION == ON
+
+		if (validate_header(stack) != STACK_OK)
+			return 0;
+
+	#endif
+
+	lock(&stack->lock);
+	size_t size = stack_size(&stack->common);
+	unlock(&stack->lock);
+
+	for (size_t i = 0; i < stack->max_workers; ++i)
+	{
+		shared_stack_local_t *local = &stack->locals[i];
+
+		lock(&local->lock);
+		size += stack_size(&local->stack);
+		unlock(&local->lock);
+	}
+
+	return size;
+}
@@ -0,0 +1,264 @@
+/*!
+ * @file
+ * This header file contains a description of the shared stack
+ * and functions for working with it.
+ *
+ * shared_stack_t is a stack for a pool of worker threads. Every worker
+ * attaches to it and gets its own local stack_t. Push and pop work with
+ * the local stack, which is guarded by its own mutex, so the workers
+ * don't contend with each other. Only when the local stack overflows
+ * or becomes empty, a batch of elements is moved to or from the common
+ * stack_t guarded by the common mutex. An idle worker can steal
+ * elements from the local stacks of other workers. If a batch
+ * can't be moved, all its elements stay where they were.
+ */
+
+
+
+
+#ifndef SHARED_STACK_H_
+#define SHARED_STACK_H_
+
+
+
+
+/*================= Connecting headers ==================*/
+
+
+#include "secure_stack.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+
+
+
+/*========================= Types ========================*/
+
+
+struct shared_stack_t_;
+
+
+/*! It is local stack of one worker thread.
+ *
+ *  Locals are in separate cache lines.
+ */
+typedef struct shared_stack_local_t_
+{
+	_Alignas(64) pthread_mutex_t lock; /*!< guards stack.               */
+	stack_t stack;                     /*!< elements of the worker.     */
+	void   *buffer;                    /*!< batch of moved elements.    */
+	size_t  index;                     /*!< index of the local.         */
+	size_t  next_free;                 /*!< next detached local.        */
+	bool    attached;                  /*!< local is used by a worker.  */
+	struct shared_stack_t_ *owner;     /*!< shared stack of the local.  */
+} shared_stack_local_t;
+
+
+/*! It is shared stack type.
+ *
+ */
+typedef struct shared_stack_t_
+{
+	#if CANARIES == ON
+		unsigned long long left_canary; /*!< left protective variable. */
+	#endif
+
+	shared_stack_local_t *locals; /*!< local stacks of workers.            */
+	size_t max_workers;           /*!< number of locals.                   */
+	size_t element_size;          /*!< size of one element in stack.       */
+	size_t batch;                 /*!< elements moved by spill or refill.  */
+	size_t local_capacity;        /*!< local stack spills if it is full.   */
+	char   name[64];              /*!< name of shared_stack_t variable.    */
+
+	#if CANARIES == ON
+		unsigned long long right_canary; /*!< right protective variable. */
+	#endif
+
+	_Alignas(64) atomic_size_t workers; /*!< number of used locals.      */
+
+	_Alignas(64) pthread_mutex_t lock;  /*!< guards common and free_local. */
+	stack_t common;                     /*!< elements spilled by workers. */
+	size_t  free_local;                 /*!< first detached local.        */
+} shared_stack_t;
+
+
+
+
+/*================= Function prototypes ==================*/
+
+
+/*! This function creates shared stack on heap.
+ *
+ * @param[in] name         - name of stack variable.
+ * @param[in] element_size - size of one element in stack.
+ * @param[in] max_workers  - max number of attached threads.
+ *
+ * @return pointer to initialized shared_stack_t value
+ *         or NULL if memory can't be allocated.
+ *
+ * @note Don't forget to free heap memory using shared_stack_delete().
+ *
+ * @note Use shared_stack_create() macro instead of this function.
+ */
+shared_stack_t *shared_stack_create_func_ (const char *name,
+		size_t element_size, size_t max_workers);
+
+
+/*! This function frees heap memory that shared_stack_t* value used.
+ *
+ *  @param[in,out] stack - pointer to the stack to be freed.
+ *
+ *  @return stack_error.
+ *
+ *  @note No thread may use the stack during this call.
+ */
+stack_error_t shared_stack_delete (shared_stack_t *stack);
+
+
+/*! This function checks the common stack and all local stacks
+ *  for integrity.
+ *
+ * @param[in] stack           - stack to be checked.
+ * @param[in] _CODE_POSITION_ - position in source code.
+ *
+ * @return stack_error
+ *
+ * @note Use shared_stack_check() macro instead of this function.
+ */
+stack_error_t shared_stack_check_func_ (shared_stack_t *stack,
+		_CODE_POSITION_T_);
+
+
+/*! This function sets how many elements are moved between local stacks
+ *  and the common stack.
+ *
+ *  @param[in,out] stack      - pointer to the stack.
+ *  @param[in] batch          - number of elements moved at once.
+ *  @param[in] local_capacity - local stack spills a batch to the common
+ *                              stack when it has so many elements.
+ *                              It must be not less than batch.
+ *
+ *  @return stack_error
+ *
+ *  @note No thread may use the stack during this call.
+ */
+stack_error_t shared_stack_set_batch (shared_stack_t *stack, size_t batch,
+		size_t local_capacity);
+
+
+/*! This function gives the local stack to the calling worker.
+ *  Locals returned by shared_stack_detach() are given first.
+ *
+ *  @param[in,out] stack - pointer to the stack.
+ *
+ *  @return pointer to the local stack or NULL if max_workers
+ *          threads are already attached.
+ *
+ *  @note The local stack must be used only by the thread which
+ *        has attached it.
+ */
+shared_stack_local_t *shared_stack_attach (shared_stack_t *stack);
+
+
+/*! This function moves all elements of the local stack
+ *  to the common stack and returns the local to the shared stack,
+ *  so another worker can attach it.
+ *
+ *  @param[in,out] local - local stack of the worker.
+ *
+ *  @return stack_error. If the elements can't be moved,
+ *          the local stays attached.
+ *
+ *  @note The worker must not use the local after it.
+ */
+stack_error_t shared_stack_detach (shared_stack_local_t *local);
+
+
+/*! This function moves all elements of the local stack
+ *  to the common stack. The worker can continue using the local
+ *  after it.
+ *
+ *  @param[in,out] local - local stack of the worker.
+ *
+ *  @return stack_error
+ */
+stack_error_t shared_stack_flush (shared_stack_local_t *local);
+
+
+/*! This function pushes a value to the local stack of the worker.
+ *  If the local stack is full, a batch of its elements is moved
+ *  to the common stack.
+ *
+ *  @param[in,out] local    - local stack of the worker.
+ *  @param[in] pushed_value - pointer to the value that will be pushed.
+ *
+ *  @return stack_error
+ */
+stack_error_t shared_stack_push (shared_stack_local_t *local,
+		const void *pushed_value);
+
+
+/*! This function pops a value from the local stack of the worker.
+ *  If the local stack is empty, it is refilled by a batch of elements
+ *  from the common stack.
+ *
+ * @param[in,out] local - local stack of the worker.
+ * @param[out] result   - pointer to memory where the result will be written.
+ *
+ * @return stack_error. STACK_EMPTY if the local and the common stacks
+ *         are empty, but other workers can still have elements.
+ */
+stack_error_t shared_stack_pop (shared_stack_local_t *local, void *result);
+
+
+/*! This function takes up to half of the elements (but not more
+ *  than a batch) from the local stack of another worker.
+ *  One of them is returned, the rest are pushed to the local stack
+ *  of the calling worker.
+ *
+ * @param[in,out] local - local stack of the calling worker.
+ * @param[out] result   - pointer to memory where the result will be written.
+ *
+ * @return stack_error. STACK_EMPTY if nothing can be stolen.
+ *
+ * @note Workers which are busy at the moment are skipped.
+ */
+stack_error_t shared_stack_steal (shared_stack_local_t *local, void *result);
+
+
+/*! This function returns the number of elements in all stacks.
+ *  The value can be out of date if other threads change the stack.
+ *
+ * @param[in] stack - pointer to the stack.
+ *
+ * @return number of elements.
+ */
+size_t shared_stack_size (shared_stack_t *stack);
+
+
+
+
+/*================== Functional macros ===================*/
+
+
+/*! This macro creates shared stack on heap
+ *  for WORKERS_ threads.
+ *
+ */
+#define shared_stack_create(NAME_, TYPE_, WORKERS_) \
+	shared_stack_t *NAME_ = shared_stack_create_func_(#NAME_,\
+			sizeof(TYPE_), WORKERS_)
+
+
+/*! This macro checks the stack for integrity.
+ *
+ * @param[in] STACK_ - stack to be checked.
+ *
+ * @return stack_error
+ */
+#define shared_stack_check(STACK_) \
+	shared_stack_check_func_(STACK_, _CURRENT_CODE_POSITION_)
+
+
+#endif
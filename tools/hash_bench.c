@@ -0,0 +1,215 @@
+/*!
+ * @file
+ * @brief Measures throughput of the hashing algorithms
+ *        and checks that all kernels of fast_hash64 are equal.
+ *
+ * Usage: hash_bench.out
+ */
+
+
+
+
+/*================= Connecting headers ==================*/
+
+
+#include "../src/hash.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+
+
+/*================== Local constants =====================*/
+
+
+#define MIN_LENGTH    ((size_t) 64)
+#define MAX_LENGTH    ((size_t) 64 << 20)
+#define LENGTH_STEP   4
+
+/* Every algorithm hashes so many bytes for every length. */
+#define BENCH_BYTES   ((size_t) 256 << 20)
+#define PEARSON_BYTES ((size_t) 16 << 20)
+
+/* Every length up to it is compared. */
+#define MAX_COMPARED_LENGTH 4096
+
+
+
+
+/*========================= Types ========================*/
+
+
+typedef struct kernel_t_
+{
+	hash_kernel_id_t id;
+	const char      *name;
+	bool             supported;
+} kernel_t;
+
+
+
+
+/*=================== Local variables ====================*/
+
+
+static kernel_t _KERNELS_[] =
+{
+	{ HASH_KERNEL_SCALAR, "scalar", false },
+	{ HASH_KERNEL_SSE2,   "sse2",   false },
+	{ HASH_KERNEL_AVX2,   "avx2",   false },
+};
+
+#define KERNELS_COUNT (sizeof _KERNELS_ / sizeof *_KERNELS_)
+
+
+
+
+/*==================== Local functions ===================*/
+
+
+static double current_time (void)
+{
+	struct timespec time = {};
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (double) time.tv_sec + (double) time.tv_nsec / 1e9;
+}
+
+
+/* Returns throughput in GB/s. */
+static double measure (hash64_func_t hash, const unsigned char *data,
+		size_t length, size_t total)
+{
+	size_t repeats = total / length;
+	if (repeats == 0)
+		repeats = 1;
+
+	volatile uint64_t sink = 0;
+	double start = current_time();
+
+	for (size_t i = 0; i < repeats; ++i)
+		sink += hash(data, length);
+
+	double seconds = current_time() - start;
+	(void) sink;
+
+	return (double) (repeats * length) / seconds / 1e9;
+}
+
+
+static void print_length (size_t length)
+{
+	if (length >= (1 << 20))
+		printf("%6zu MB", length >> 20);
+	else if (length >= (1 << 10))
+		printf("%6zu KB", length >> 10);
+	else
+		printf("%6zu B ", length);
+}
+
+
+/* Compares the supported kernels and fast_hash64_inline
+ * on every length up to MAX_COMPARED_LENGTH and on the benchmarked
+ * lengths, data is unaligned on purpose. */
+static bool kernels_are_equal (const unsigned char *data)
+{
+	for (size_t length = 1; length <= MAX_LENGTH - 1;
+	     length = length < MAX_COMPARED_LENGTH ? length + 1 :
+	                                             length * LENGTH_STEP)
+	{
+		uint64_t expected = 0;
+		bool first = true;
+
+		for (size_t k = 0; k < KERNELS_COUNT; ++k)
+		{
+			if (!_KERNELS_[k].supported)
+				continue;
+
+			set_hash_kernel(_KERNELS_[k].id);
+			uint64_t hash = fast_hash64(data + 1, length);
+
+			if (first)
+				expected = hash;
+			else if (hash != expected)
+			{
+				printf("Kernel %s differs on %zu bytes: "
+						"%016llx != %016llx\n", _KERNELS_[k].name, length,
+						(unsigned long long) hash,
+						(unsigned long long) expected);
+				return false;
+			}
+			first = false;
+		}
+
+		uint64_t hash = fast_hash64_inline(data + 1, length);
+		if (hash != expected)
+		{
+			printf("fast_hash64_inline differs on %zu bytes: "
+					"%016llx != %016llx\n", length,
+					(unsigned long long) hash,
+					(unsigned long long) expected);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+
+
+/*======================== Main ==========================*/
+
+
+int main (void)
+{
+	unsigned char *data = (unsigned char *) malloc(MAX_LENGTH);
+	if (!data)
+	{
+		perror("hash_bench");
+		return EXIT_FAILURE;
+	}
+
+	srand(1);
+	for (size_t i = 0; i < MAX_LENGTH; ++i)
+		data[i] = (unsigned char) rand();
+
+	for (size_t k = 0; k < KERNELS_COUNT; ++k)
+		_KERNELS_[k].supported = set_hash_kernel(_KERNELS_[k].id);
+
+	bool equal = kernels_are_equal(data);
+	printf("Kernels of fast_hash64 %s.\n\n",
+			equal ? "return equal values" : "DIFFER");
+
+	printf("Throughput, GB/s:\n  length   pearson");
+	for (size_t k = 0; k < KERNELS_COUNT; ++k)
+		printf("%10s", _KERNELS_[k].name);
+	printf("\n");
+
+	for (size_t length = MIN_LENGTH; length <= MAX_LENGTH;
+	     length *= LENGTH_STEP)
+	{
+		print_length(length);
+		printf("%10.2f", measure(pearson_hash64, data, length,
+				PEARSON_BYTES));
+
+		for (size_t k = 0; k < KERNELS_COUNT; ++k)
+		{
+			if (!_KERNELS_[k].supported)
+			{
+				printf("%10s", "-");
+				continue;
+			}
+
+			set_hash_kernel(_KERNELS_[k].id);
+			printf("%10.2f", measure(fast_hash64, data, length,
+					BENCH_BYTES));
+		}
+		printf("\n");
+	}
+
+	free(data);
+	return equal ? EXIT_SUCCESS : EXIT_FAILURE;
+}
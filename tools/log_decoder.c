@@ -0,0 +1,395 @@
+/*!
+ * @file
+ * @brief Converts binary log file to the text format of file logs.
+ *
+ * Usage: log_decoder.out [-t] binary_log_file
+ *   -t - print timestamp before every top-level log.
+ */
+
+
+
+
+/*================= Connecting headers ==================*/
+
+
+#include "../src/binary_log.h"
+#include "../src/logging.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+
+
+/*========================= Types ========================*/
+
+
+typedef struct position_t_
+{
+	char     *fname;
+	char     *func;
+	uint32_t  line;
+} position_t;
+
+
+typedef struct positions_t_
+{
+	position_t *arr;
+	size_t      size;
+} positions_t;
+
+
+typedef struct frame_t_
+{
+	uint64_t  address;
+	char     *symbol;
+} frame_t;
+
+
+/* Open addressing table of symbols of return addresses. */
+typedef struct frames_t_
+{
+	frame_t *table;
+	size_t   capacity;
+	size_t   count;
+} frames_t;
+
+
+
+
+/*==================== Local functions ===================*/
+
+
+static void print_tabs (int n, FILE *fp)
+{
+	for (int i = 0; i < n; ++i)
+		fputc('\t', fp);
+}
+
+
+static const char *danger_str (uint8_t danger)
+{
+	switch ( danger )
+	{
+		case EMPTY:
+			return "";
+		case OK:
+			return "[OK]:";
+		case WARNING:
+			return "==> WARNING:";
+		case ERROR:
+			return "!!! ERROR:";
+		default:
+			return "--> UNKNOWN:";
+	}
+}
+
+
+/* Reads length bytes and adds terminating zero. */
+static char *read_string (FILE *fp, uint32_t length)
+{
+	char *str = (char *) malloc((size_t) length + 1);
+	if (!str)
+		return NULL;
+
+	if (fread(str, 1, length, fp) != length)
+	{
+		free(str);
+		return NULL;
+	}
+	str[length] = '\0';
+
+	return str;
+}
+
+
+static bool read_position (FILE *fp, positions_t *positions)
+{
+	binlog_position_t record = {};
+	if (fread((char *) &record + 1, sizeof record - 1, 1, fp) != 1)
+		return false;
+
+	if (record.id >= positions->size)
+	{
+		size_t new_size = positions->size ? positions->size : 64;
+		while (new_size <= record.id)
+			new_size *= 2;
+
+		position_t *new_arr = (position_t *) realloc(positions->arr,
+				new_size * sizeof *new_arr);
+		if (!new_arr)
+			return false;
+
+		memset(new_arr + positions->size, 0,
+				(new_size - positions->size) * sizeof *new_arr);
+		positions->arr  = new_arr;
+		positions->size = new_size;
+	}
+
+	/* Appended logs define the same ids again. */
+	position_t *pos = &positions->arr[record.id];
+	free(pos->fname);
+	free(pos->func);
+
+	pos->line  = record.line;
+	pos->fname = read_string(fp, record.fname_length);
+	pos->func  = read_string(fp, record.func_length);
+
+	return pos->fname && pos->func;
+}
+
+
+static size_t frame_index (uint64_t address, size_t capacity)
+{
+	uint64_t key = address * 0x9E3779B97F4A7C15ULL;
+	key ^= key >> 29;
+	return (size_t) key & (capacity - 1);
+}
+
+
+static frame_t *find_frame (const frames_t *frames, uint64_t address)
+{
+	if (frames->capacity == 0)
+		return NULL;
+
+	size_t index = frame_index(address, frames->capacity);
+	while (frames->table[index].symbol)
+	{
+		if (frames->table[index].address == address)
+			return &frames->table[index];
+		index = (index + 1) & (frames->capacity - 1);
+	}
+	return &frames->table[index];
+}
+
+
+static bool grow_frames (frames_t *frames)
+{
+	frames_t new_frames =
+	{
+		NULL,
+		frames->capacity ? frames->capacity * 2 : 256,
+		frames->count,
+	};
+	new_frames.table = (frame_t *) calloc(new_frames.capacity,
+			sizeof *new_frames.table);
+	if (!new_frames.table)
+		return false;
+
+	for (size_t i = 0; i < frames->capacity; ++i)
+	{
+		if (frames->table[i].symbol)
+			*find_frame(&new_frames, frames->table[i].address) =
+					frames->table[i];
+	}
+
+	free(frames->table);
+	*frames = new_frames;
+
+	return true;
+}
+
+
+static bool read_frame (FILE *fp, frames_t *frames)
+{
+	binlog_frame_t record = {};
+	if (fread((char *) &record + 1, sizeof record - 1, 1, fp) != 1)
+		return false;
+
+	char *symbol = read_string(fp, record.symbol_length);
+	if (!symbol)
+		return false;
+
+	if ((frames->count + 1) * 2 > frames->capacity && !grow_frames(frames))
+	{
+		free(symbol);
+		return false;
+	}
+
+	/* Appended logs define the same addresses again. */
+	frame_t *frame = find_frame(frames, record.address);
+	if (frame->symbol)
+		free(frame->symbol);
+	else
+		frames->count++;
+
+	frame->address = record.address;
+	frame->symbol  = symbol;
+
+	return true;
+}
+
+
+static bool print_stack_trace (FILE *fp, const frames_t *frames,
+		uint32_t depth)
+{
+	printf("============> STACK TRACE <=============\n");
+	for (uint32_t i = 0; i < depth; ++i)
+	{
+		uint64_t address = 0;
+		if (fread(&address, sizeof address, 1, fp) != 1)
+			return false;
+
+		frame_t *frame = find_frame(frames, address);
+		if (frame && frame->symbol)
+			printf("%s\n", frame->symbol);
+		else
+			printf("[%#llx]\n", (unsigned long long) address);
+	}
+	putchar('\n');
+
+	return true;
+}
+
+
+static void print_timestamp (uint64_t timestamp)
+{
+	time_t seconds = (time_t) (timestamp / 1000000000);
+	struct tm tm = {};
+	localtime_r(&seconds, &tm);
+
+	char str[64];
+	strftime(str, sizeof str, "%Y-%m-%d %H:%M:%S", &tm);
+	printf("[%s.%09llu]\n", str,
+			(unsigned long long) (timestamp % 1000000000));
+}
+
+
+/* Prints entry in the same way as logging to file does. */
+static bool print_entry (FILE *fp, const positions_t *positions,
+		const frames_t *frames, bool timestamps)
+{
+	binlog_entry_t entry = {};
+	if (fread((char *) &entry + 1, sizeof entry - 1, 1, fp) != 1)
+		return false;
+
+	static const position_t UNKNOWN = { (char *) "?", (char *) "?", 0 };
+	const position_t *pos = &UNKNOWN;
+	if (entry.position < positions->size &&
+			positions->arr[entry.position].fname)
+		pos = &positions->arr[entry.position];
+
+	char *msg   = read_string(fp, entry.msg_length);
+	char *data  = read_string(fp, entry.data_length);
+	bool success = msg && data;
+
+	if (success)
+	{
+		if (timestamps && entry.deep_lvl == 0)
+			print_timestamp(entry.timestamp);
+
+		print_tabs(entry.deep_lvl, stdout);
+		if (entry.deep_lvl == 0)
+			printf("%s In %s: %s():%u: %s\n", danger_str(entry.danger),
+					pos->fname, pos->func, pos->line, msg);
+		else
+			printf("%s %s\n", danger_str(entry.danger), msg);
+
+		print_tabs(entry.deep_lvl, stdout);
+		printf("%s\n\n", data);
+
+		if ((entry.flags & BINLOG_HAS_TRACE) && entry.deep_lvl == 0)
+			success = print_stack_trace(fp, frames, entry.trace_depth);
+
+		putchar('\n');
+	}
+
+	free(msg);
+	free(data);
+
+	return success;
+}
+
+
+static bool check_file_header (FILE *fp)
+{
+	binlog_file_header_t header = {};
+	if (fread(&header, sizeof header, 1, fp) != 1 ||
+			memcmp(header.magic, BINLOG_MAGIC, sizeof header.magic) != 0)
+	{
+		fprintf(stderr, "It isn't a binary log file.\n");
+		return false;
+	}
+	if (header.byte_order != BINLOG_BYTE_ORDER)
+	{
+		fprintf(stderr, "Log was written on a machine "
+				"with another byte order.\n");
+		return false;
+	}
+	if (header.version != BINLOG_VERSION)
+	{
+		fprintf(stderr, "Unsupported version of log file: %u.\n",
+				(unsigned) header.version);
+		return false;
+	}
+	return true;
+}
+
+
+
+
+/*======================== Main ==========================*/
+
+
+int main (int argc, char *argv[])
+{
+	bool timestamps = false;
+	const char *fname = NULL;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-t") == 0)
+			timestamps = true;
+		else
+			fname = argv[i];
+	}
+
+	if (!fname)
+	{
+		fprintf(stderr, "Usage: %s [-t] binary_log_file\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	FILE *fp = fopen(fname, "rb");
+	if (!fp)
+	{
+		perror(fname);
+		return EXIT_FAILURE;
+	}
+
+	positions_t positions = {};
+	frames_t    frames    = {};
+	bool success = check_file_header(fp);
+
+	int type = 0;
+	while (success && (type = fgetc(fp)) != EOF)
+	{
+		if (type == BINLOG_POSITION)
+			success = read_position(fp, &positions);
+		else if (type == BINLOG_FRAME)
+			success = read_frame(fp, &frames);
+		else if (type == BINLOG_ENTRY)
+			success = print_entry(fp, &positions, &frames, timestamps);
+		else
+			success = false;
+
+		if (!success)
+			fprintf(stderr, "Log file is damaged at %ld.\n", ftell(fp));
+	}
+
+	for (size_t i = 0; i < positions.size; ++i)
+	{
+		free(positions.arr[i].fname);
+		free(positions.arr[i].func);
+	}
+	free(positions.arr);
+	for (size_t i = 0; i < frames.capacity; ++i)
+		free(frames.table[i].symbol);
+	free(frames.table);
+	fclose(fp);
+
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}